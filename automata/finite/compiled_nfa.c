@@ -0,0 +1,1037 @@
+#include "compiled_nfa.h"
+#include "nfa_delta_function.h"
+#include "graph.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BITS_PER_WORD 64
+#define CLASS_PAGE_BITS 8
+#define CLASS_PAGE_SIZE (1u << CLASS_PAGE_BITS)
+
+struct state_entry
+{
+    word state;
+    unsigned int id;
+};
+
+/* states are numbered 0..state_count - 1 in the order of the state set. Letters of Σ whose
+   transitions agree from every state share one class, found through the two-level map
+   class_of[page_of[code >> CLASS_PAGE_BITS] * CLASS_PAGE_SIZE + (code & (CLASS_PAGE_SIZE - 1))]
+   in which page 0 is all zeros; class 0 stands for all letters that move nowhere, inside Σ or
+   not. The successors of state s on class k are successors[successor_start[s * classes + k]]
+   up to the start of the next row, so the table is dense in the states times the distinct
+   columns of δ rather than times |Σ|. The ε-transitions of s are kept apart in epsilon_start
+   and epsilon_targets. States that reach each other over ε share one ε-component; component k
+   holds the ids members[member_start[k]] up to the start of the next component and moves over
+   ε into the components component_targets[component_edge_start[k]] up to the start of the
+   next, each listed once. The ε-closure of s is the union of the components reached from
+   component_of[s] */
+struct compiled_nfa_
+{
+    n_tuple nfa;
+    unsigned int state_count;
+    unsigned int words;
+    unsigned int start;
+    unsigned int classes;
+    unsigned int code_pages;
+    unsigned int class_pages;
+    unsigned int edges;
+    unsigned int epsilons;
+    unsigned int components;
+    unsigned int component_edges;
+    uint64_t *final;
+    word *states;
+    struct state_entry *sorted;
+    unsigned int *successor_start;
+    unsigned int *successors;
+    unsigned int *epsilon_start;
+    unsigned int *epsilon_targets;
+    unsigned int *page_of;
+    unsigned int *class_of;
+    unsigned int *component_of;
+    unsigned int *member_start;
+    unsigned int *members;
+    unsigned int *component_edge_start;
+    unsigned int *component_targets;
+};
+
+/* a letter transition by the objects it connects, see LetterColumns */
+struct letter_edge
+{
+    letter let;
+    word from;
+    word to;
+};
+
+static int compareStateEntries(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const struct state_entry *)a)->state;
+    uintptr_t y = (uintptr_t)((const struct state_entry *)b)->state;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static void *carve(char *base, size_t *offset, size_t bytes)
+{
+    void *p = (base != NULL) ? base + *offset : NULL;
+    *offset += bytes;
+    return p;
+}
+
+/* places the arrays behind the header according to the counts in it and returns the size of
+   the whole block, with base NULL only the size is computed; widest elements come first so
+   every array stays aligned, and the components come last so the block can grow once they
+   are known without moving anything else */
+static size_t layoutCompiledNFA(struct compiled_nfa_ *c, char *base)
+{
+    size_t n = c->state_count;
+    size_t rows = n * c->classes;
+    size_t offset = sizeof(struct compiled_nfa_);
+    c->final = carve(base, &offset, (c->words + 1) * sizeof(uint64_t));
+    c->sorted = carve(base, &offset, (n + 1) * sizeof(struct state_entry));
+    c->states = carve(base, &offset, (n + 1) * sizeof(word));
+    c->successor_start = carve(base, &offset, (rows + 1) * sizeof(unsigned int));
+    c->successors = carve(base, &offset, (c->edges + 1) * sizeof(unsigned int));
+    c->epsilon_start = carve(base, &offset, (n + 1) * sizeof(unsigned int));
+    c->epsilon_targets = carve(base, &offset, (c->epsilons + 1) * sizeof(unsigned int));
+    c->page_of = carve(base, &offset, (c->code_pages + 1) * sizeof(unsigned int));
+    c->class_of = carve(base, &offset, (size_t)c->class_pages * CLASS_PAGE_SIZE * sizeof(unsigned int));
+    c->component_of = carve(base, &offset, (n + 1) * sizeof(unsigned int));
+    c->member_start = carve(base, &offset, (c->components + 1) * sizeof(unsigned int));
+    c->members = carve(base, &offset, (n + 1) * sizeof(unsigned int));
+    c->component_edge_start = carve(base, &offset, (c->components + 1) * sizeof(unsigned int));
+    c->component_targets = carve(base, &offset, (c->component_edges + 1) * sizeof(unsigned int));
+    return offset;
+}
+
+static bool hasState(const uint64_t *bits, unsigned int id)
+{
+    return (bits[id / BITS_PER_WORD] >> (id % BITS_PER_WORD)) & 1;
+}
+
+static void addState(uint64_t *bits, unsigned int id)
+{
+    bits[id / BITS_PER_WORD] |= (uint64_t)1 << (id % BITS_PER_WORD);
+}
+
+static unsigned int idOf(const struct compiled_nfa_ *c, word state)
+{
+    struct state_entry key;
+    key.state = state;
+    key.id = 0;
+    const struct state_entry *entry = bsearch(&key, c->sorted, c->state_count, sizeof(struct state_entry), compareStateEntries);
+    return (entry != NULL) ? entry->id : NO_COMPILED_STATE;
+}
+
+static unsigned int classOf(compiled_nfa c, unsigned int code)
+{
+    unsigned int page = code >> CLASS_PAGE_BITS;
+    if (page >= c->code_pages)
+        return 0;
+
+    return c->class_of[c->page_of[page] * CLASS_PAGE_SIZE + (code & (CLASS_PAGE_SIZE - 1))];
+}
+
+static int compareLetterEdges(const void *a, const void *b)
+{
+    const struct letter_edge *x = a;
+    const struct letter_edge *y = b;
+    if (x->let != y->let)
+        return ((uintptr_t)x->let < (uintptr_t)y->let) ? -1 : 1;
+    if (x->from != y->from)
+        return ((uintptr_t)x->from < (uintptr_t)y->from) ? -1 : 1;
+    if (x->to != y->to)
+        return ((uintptr_t)x->to < (uintptr_t)y->to) ? -1 : 1;
+    return 0;
+}
+
+/* the letter transitions of δ sorted by letter, so that the column of each letter is one run
+   of them; letters with equal columns share a class, numbered from 1 in the order of their
+   first run, and that run stands for the whole class */
+struct letter_columns
+{
+    unsigned int runs;
+    unsigned int classes;
+    unsigned int *run_start;
+    unsigned int *run_class;
+    unsigned int *class_run;
+    struct letter_edge *edges;
+};
+
+static bool haveSameColumn(const struct letter_columns *l, unsigned int a, unsigned int b)
+{
+    unsigned int length = l->run_start[a + 1] - l->run_start[a];
+    if (length != l->run_start[b + 1] - l->run_start[b])
+        return false;
+
+    for (unsigned int e = 0; e < length; e++)
+    {
+        const struct letter_edge *x = &l->edges[l->run_start[a] + e];
+        const struct letter_edge *y = &l->edges[l->run_start[b] + e];
+        if (x->from != y->from || x->to != y->to)
+            return false;
+    }
+
+    return true;
+}
+
+static uint64_t hashColumn(const struct letter_columns *l, unsigned int r)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned int e = l->run_start[r]; e < l->run_start[r + 1]; e++)
+    {
+        h = (h ^ (uintptr_t)l->edges[e].from) * 0x100000001b3ULL;
+        h = (h ^ (uintptr_t)l->edges[e].to) * 0x100000001b3ULL;
+    }
+
+    return h ^ (h >> 32);
+}
+
+static struct letter_columns LetterColumns(set alphabet, nfa_delta_function delta, unsigned int edges)
+{
+    struct letter_columns l;
+    l.edges = malloc((edges + 1) * sizeof(struct letter_edge));
+    assert(l.edges != NULL);
+    (void)alphabet;
+
+    unsigned int length = 0;
+    for (set_iterator i = SetIterator(delta); hasNextElement(&i);)
+    {
+        n_tuple tuple = nextElement(&i);
+        set from = getObjectByIndex(tuple, 0);
+        letter let = getLetterFromNFADeltaFunctionDomainElement(from);
+        if (let == letter_epsilon)
+            continue;
+        assert(isElementOf(alphabet, let) && "Transition on a letter that is not in Σ.");
+
+        for (set_iterator j = SetIterator(getObjectByIndex(tuple, 1)); hasNextElement(&j);)
+        {
+            l.edges[length].let = let;
+            l.edges[length].from = getWordFromNFADeltaFunctionDomainElement(from);
+            l.edges[length].to = nextElement(&j);
+            length++;
+        }
+    }
+    qsort(l.edges, length, sizeof(struct letter_edge), compareLetterEdges);
+
+    l.run_start = malloc((length + 1) * sizeof(unsigned int));
+    assert(l.run_start != NULL);
+    l.runs = 0;
+    for (unsigned int e = 0; e < length; e++)
+    {
+        if (e == 0 || l.edges[e].let != l.edges[e - 1].let)
+            l.run_start[l.runs++] = e;
+    }
+    l.run_start[l.runs] = length;
+
+    unsigned int size = 1;
+    while (size < 2 * l.runs + 1)
+        size *= 2;
+    unsigned int *slots = malloc(size * sizeof(unsigned int));
+    l.run_class = malloc((l.runs + 1) * sizeof(unsigned int));
+    l.class_run = malloc((l.runs + 2) * sizeof(unsigned int));
+    assert(slots != NULL && l.run_class != NULL && l.class_run != NULL);
+    memset(slots, 0xff, size * sizeof(unsigned int));
+
+    l.classes = 1;
+    for (unsigned int r = 0; r < l.runs; r++)
+    {
+        unsigned int i = (unsigned int)hashColumn(&l, r) & (size - 1);
+        while (slots[i] != NO_COMPILED_STATE && !haveSameColumn(&l, slots[i], r))
+            i = (i + 1) & (size - 1);
+
+        if (slots[i] == NO_COMPILED_STATE)
+        {
+            slots[i] = r;
+            l.run_class[r] = l.classes;
+            l.class_run[l.classes++] = r;
+        }
+        else
+        {
+            l.run_class[r] = l.run_class[slots[i]];
+        }
+    }
+
+    free(slots);
+    return l;
+}
+
+static void freeLetterColumns(struct letter_columns *l)
+{
+    free(l->run_start);
+    free(l->run_class);
+    free(l->class_run);
+    free(l->edges);
+}
+
+static unsigned int transitionEndOf(const struct compiled_nfa_ *c, word state)
+{
+    unsigned int id = idOf(c, state);
+    assert(id != NO_COMPILED_STATE && "Transition between states that are not in Q.");
+    return id;
+}
+
+/* transitions are counted into the row starts first, then the prefix sums are used as fill
+   cursors */
+static void fillTransitions(struct compiled_nfa_ *c, nfa_delta_function delta, const struct letter_columns *l)
+{
+    unsigned int n = c->state_count;
+    unsigned int rows = n * c->classes;
+    for (unsigned int k = 1; k < c->classes; k++)
+    {
+        unsigned int r = l->class_run[k];
+        for (unsigned int e = l->run_start[r]; e < l->run_start[r + 1]; e++)
+            c->successor_start[transitionEndOf(c, l->edges[e].from) * c->classes + k + 1]++;
+    }
+    for (set_iterator i = SetIterator(delta); hasNextElement(&i);)
+    {
+        n_tuple tuple = nextElement(&i);
+        set from = getObjectByIndex(tuple, 0);
+        if (getLetterFromNFADeltaFunctionDomainElement(from) != letter_epsilon)
+            continue;
+
+        unsigned int s = transitionEndOf(c, getWordFromNFADeltaFunctionDomainElement(from));
+        c->epsilon_start[s + 1] += getCardinality(getObjectByIndex(tuple, 1));
+    }
+    for (unsigned int row = 0; row < rows; row++)
+    {
+        c->successor_start[row + 1] += c->successor_start[row];
+    }
+    for (unsigned int s = 0; s < n; s++)
+    {
+        c->epsilon_start[s + 1] += c->epsilon_start[s];
+    }
+
+    unsigned int *successor_fill = malloc((rows + 1) * sizeof(unsigned int));
+    unsigned int *epsilon_fill = malloc((n + 1) * sizeof(unsigned int));
+    assert(successor_fill != NULL && epsilon_fill != NULL);
+    memcpy(successor_fill, c->successor_start, (rows + 1) * sizeof(unsigned int));
+    memcpy(epsilon_fill, c->epsilon_start, (n + 1) * sizeof(unsigned int));
+
+    for (unsigned int k = 1; k < c->classes; k++)
+    {
+        unsigned int r = l->class_run[k];
+        for (unsigned int e = l->run_start[r]; e < l->run_start[r + 1]; e++)
+        {
+            unsigned int row = transitionEndOf(c, l->edges[e].from) * c->classes + k;
+            c->successors[successor_fill[row]++] = transitionEndOf(c, l->edges[e].to);
+        }
+    }
+    for (set_iterator i = SetIterator(delta); hasNextElement(&i);)
+    {
+        n_tuple tuple = nextElement(&i);
+        set from = getObjectByIndex(tuple, 0);
+        if (getLetterFromNFADeltaFunctionDomainElement(from) != letter_epsilon)
+            continue;
+
+        unsigned int s = transitionEndOf(c, getWordFromNFADeltaFunctionDomainElement(from));
+        for (set_iterator j = SetIterator(getObjectByIndex(tuple, 1)); hasNextElement(&j);)
+            c->epsilon_targets[epsilon_fill[s]++] = transitionEndOf(c, nextElement(&j));
+    }
+
+    free(successor_fill);
+    free(epsilon_fill);
+}
+
+static graph epsilonGraph(compiled_nfa c)
+{
+    graph g = {c->state_count, c->epsilon_start, c->epsilon_targets};
+    return g;
+}
+
+static graph componentGraph(compiled_nfa c)
+{
+    graph g = {c->components, c->component_edge_start, c->component_targets};
+    return g;
+}
+
+/* the ε-components and the ε-transitions between them, collapsed to one edge per pair of
+   components; seen[d] holds the last component found to move into d */
+static struct compiled_nfa_ *fillComponents(struct compiled_nfa_ *c)
+{
+    unsigned int n = c->state_count;
+    graph_components components = GraphComponents(epsilonGraph(c));
+    unsigned int *seen = malloc((components.count + 1) * sizeof(unsigned int));
+    assert(seen != NULL);
+
+    unsigned int length = 0;
+    for (unsigned int pass = 0; pass < 2; pass++)
+    {
+        memset(seen, 0xff, components.count * sizeof(unsigned int));
+        length = 0;
+        for (unsigned int k = 0; k < components.count; k++)
+        {
+            if (pass == 1)
+                c->component_edge_start[k] = length;
+
+            for (unsigned int m = components.member_start[k]; m < components.member_start[k + 1]; m++)
+            {
+                unsigned int v = components.members[m];
+                for (unsigned int e = c->epsilon_start[v]; e < c->epsilon_start[v + 1]; e++)
+                {
+                    unsigned int d = components.component_of[c->epsilon_targets[e]];
+                    if (d == k || seen[d] == k)
+                        continue;
+
+                    seen[d] = k;
+                    if (pass == 1)
+                        c->component_targets[length] = d;
+                    length++;
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            c->components = components.count;
+            c->component_edges = length;
+            c = realloc(c, layoutCompiledNFA(c, NULL));
+            assert(c != NULL);
+            (void)layoutCompiledNFA(c, (char *)c);
+        }
+    }
+    c->component_edge_start[components.count] = length;
+
+    memcpy(c->component_of, components.component_of, n * sizeof(unsigned int));
+    memcpy(c->member_start, components.member_start, (components.count + 1) * sizeof(unsigned int));
+    memcpy(c->members, components.members, n * sizeof(unsigned int));
+
+    free(seen);
+    freeGraphComponents(&components);
+    return c;
+}
+
+/* compiled once per automaton and kept with its tuple for as long as the tuple lives */
+compiled_nfa compileNFA(n_tuple nfa)
+{
+    struct compiled_nfa_ *c = getSetIndex(nfa);
+    if (c != NULL)
+        return c;
+
+    set states = getObjectByIndex(nfa, 0);
+    set alphabet = getObjectByIndex(nfa, 1);
+    nfa_delta_function delta = getObjectByIndex(nfa, 2);
+    word start = getObjectByIndex(nfa, 3);
+    set final_states = getObjectByIndex(nfa, 4);
+
+    unsigned int n = getCardinality(states);
+    unsigned int words = (n + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    unsigned int letter_edges = 0;
+    unsigned int epsilons = 0;
+    for (set_iterator i = SetIterator(delta); hasNextElement(&i);)
+    {
+        n_tuple tuple = nextElement(&i);
+        unsigned int targets = getCardinality(getObjectByIndex(tuple, 1));
+        if (getLetterFromNFADeltaFunctionDomainElement(getObjectByIndex(tuple, 0)) == letter_epsilon)
+            epsilons += targets;
+        else
+            letter_edges += targets;
+    }
+
+    struct letter_columns columns = LetterColumns(alphabet, delta, letter_edges);
+    unsigned int edges = 0;
+    for (unsigned int k = 1; k < columns.classes; k++)
+        edges += columns.run_start[columns.class_run[k] + 1] - columns.run_start[columns.class_run[k]];
+
+    unsigned int code_pages = 0;
+    for (unsigned int r = 0; r < columns.runs; r++)
+    {
+        unsigned int page = getLetterCode(columns.edges[columns.run_start[r]].let) >> CLASS_PAGE_BITS;
+        if (page >= code_pages)
+            code_pages = page + 1;
+    }
+    bool *used = calloc(code_pages + 1, sizeof(bool));
+    assert(used != NULL);
+    unsigned int class_pages = 1;
+    for (unsigned int r = 0; r < columns.runs; r++)
+    {
+        unsigned int page = getLetterCode(columns.edges[columns.run_start[r]].let) >> CLASS_PAGE_BITS;
+        if (!used[page])
+            class_pages++;
+        used[page] = true;
+    }
+    free(used);
+
+    struct compiled_nfa_ header;
+    memset(&header, 0, sizeof(struct compiled_nfa_));
+    header.nfa = nfa;
+    header.state_count = n;
+    header.words = words;
+    header.classes = columns.classes;
+    header.code_pages = code_pages;
+    header.class_pages = class_pages;
+    header.edges = edges;
+    header.epsilons = epsilons;
+
+    c = calloc(1, layoutCompiledNFA(&header, NULL));
+    assert(c != NULL);
+    *c = header;
+    (void)layoutCompiledNFA(c, (char *)c);
+
+    unsigned int pages = 1;
+    for (unsigned int r = 0; r < columns.runs; r++)
+    {
+        unsigned int code = getLetterCode(columns.edges[columns.run_start[r]].let);
+        if (c->page_of[code >> CLASS_PAGE_BITS] == 0)
+            c->page_of[code >> CLASS_PAGE_BITS] = pages++;
+        c->class_of[c->page_of[code >> CLASS_PAGE_BITS] * CLASS_PAGE_SIZE + (code & (CLASS_PAGE_SIZE - 1))] = columns.run_class[r];
+    }
+
+    unsigned int k = 0;
+    for (set_iterator i = SetIterator(states); hasNextElement(&i); k++)
+    {
+        c->states[k] = nextElement(&i);
+        c->sorted[k].state = c->states[k];
+        c->sorted[k].id = k;
+    }
+    qsort(c->sorted, n, sizeof(struct state_entry), compareStateEntries);
+
+    c->start = idOf(c, start);
+    assert(c->start != NO_COMPILED_STATE && "The start state is not in Q.");
+    for (set_iterator i = SetIterator(final_states); hasNextElement(&i);)
+    {
+        unsigned int id = idOf(c, nextElement(&i));
+        assert(id != NO_COMPILED_STATE && "A final state is not in Q.");
+        addState(c->final, id);
+    }
+
+    fillTransitions(c, delta, &columns);
+    freeLetterColumns(&columns);
+    c = fillComponents(c);
+
+    return attachSetIndex(nfa, c);
+}
+
+n_tuple getCompiledNFATuple(compiled_nfa c)
+{
+    return c->nfa;
+}
+
+unsigned int getCompiledStateCount(compiled_nfa c)
+{
+    return c->state_count;
+}
+
+word getCompiledState(compiled_nfa c, unsigned int id)
+{
+    assert(id < c->state_count);
+    return c->states[id];
+}
+
+unsigned int getCompiledStateId(compiled_nfa c, word state)
+{
+    return idOf(c, state);
+}
+
+unsigned int getCompiledStart(compiled_nfa c)
+{
+    return c->start;
+}
+
+/* including class 0 */
+unsigned int getCompiledClassCount(compiled_nfa c)
+{
+    return c->classes;
+}
+
+bool isCompiledStateFinal(compiled_nfa c, unsigned int id)
+{
+    assert(id < c->state_count);
+    return hasState(c->final, id);
+}
+
+/* queue[0] up to queue[tail] are components marked in reached already; they and every
+   component they reach over ε are marked and entered once, and their members added to bits.
+   Returns the number of states added */
+static unsigned int addClosures(compiled_nfa c, uint64_t *bits, uint64_t *reached, unsigned int *queue, unsigned int tail)
+{
+    tail = reachVertices(componentGraph(c), reached, queue, tail);
+
+    unsigned int added = 0;
+    for (unsigned int j = 0; j < tail; j++)
+    {
+        unsigned int k = queue[j];
+        for (unsigned int m = c->member_start[k]; m < c->member_start[k + 1]; m++)
+            addState(bits, c->members[m]);
+        added += c->member_start[k + 1] - c->member_start[k];
+    }
+
+    return added;
+}
+
+compiled_nfa_run CompiledNFARun(compiled_nfa c)
+{
+    compiled_nfa_run r;
+    r.nfa = c;
+    r.states = calloc(c->words + 1, sizeof(uint64_t));
+    r.next = calloc(c->words + 1, sizeof(uint64_t));
+    r.components = calloc(c->components / BITS_PER_WORD + 1, sizeof(uint64_t));
+    r.queue = malloc((c->components + 1) * sizeof(unsigned int));
+    assert(r.states != NULL && r.next != NULL && r.components != NULL && r.queue != NULL);
+
+    r.queue[0] = c->component_of[c->start];
+    addState(r.components, r.queue[0]);
+    r.active = addClosures(c, r.states, r.components, r.queue, 1);
+    return r;
+}
+
+/* every successor only queues its ε-component, then the closures of all of them are entered
+   together, so a step costs the successors plus the components it enters and their ε-edges,
+   each of which it takes at most once; once no state is left the input can no longer be
+   accepted, the rest is only skipped */
+void stepCompiledNFARunByCode(compiled_nfa_run *r, unsigned int code)
+{
+    if (r->active == 0)
+        return;
+
+    compiled_nfa c = r->nfa;
+    unsigned int k = classOf(c, code);
+    unsigned int tail = 0;
+    memset(r->next, 0, c->words * sizeof(uint64_t));
+    memset(r->components, 0, (c->components / BITS_PER_WORD + 1) * sizeof(uint64_t));
+    if (k != 0)
+    {
+        for (unsigned int w = 0; w < c->words; w++)
+        {
+            for (uint64_t chunk = r->states[w]; chunk != 0; chunk &= chunk - 1)
+            {
+                unsigned int row = (w * BITS_PER_WORD + (unsigned int)__builtin_ctzll(chunk)) * c->classes + k;
+                for (unsigned int j = c->successor_start[row]; j < c->successor_start[row + 1]; j++)
+                {
+                    unsigned int d = c->component_of[c->successors[j]];
+                    if (!hasState(r->components, d))
+                    {
+                        addState(r->components, d);
+                        r->queue[tail++] = d;
+                    }
+                }
+            }
+        }
+    }
+    r->active = addClosures(c, r->next, r->components, r->queue, tail);
+
+    uint64_t *states = r->next;
+    r->next = r->states;
+    r->states = states;
+}
+
+/* NULL stands for a letter that is in no alphabet at all */
+void stepCompiledNFARun(compiled_nfa_run *r, letter let)
+{
+    stepCompiledNFARunByCode(r, (let != NULL) ? getLetterCode(let) : SIZE_OF_LETTER_TABLE);
+}
+
+bool isCompiledNFARunAccepting(const compiled_nfa_run *r)
+{
+    for (unsigned int w = 0; w < r->nfa->words; w++)
+    {
+        if ((r->states[w] & r->nfa->final[w]) != 0)
+            return true;
+    }
+
+    return false;
+}
+
+void freeCompiledNFARun(compiled_nfa_run *r)
+{
+    free(r->states);
+    free(r->next);
+    free(r->components);
+    free(r->queue);
+}
+
+bool runCompiledNFA(compiled_nfa c, packed_word input)
+{
+    compiled_nfa_run r = CompiledNFARun(c);
+    for (unsigned int i = 0; i < getPackedLength(input) && r.active > 0; i++)
+    {
+        stepCompiledNFARunByCode(&r, input.codes[i]);
+    }
+
+    bool accepted = isCompiledNFARunAccepting(&r);
+    freeCompiledNFARun(&r);
+    return accepted;
+}
+
+struct ranked_edge
+{
+    unsigned int k;
+    unsigned int to;
+};
+
+/* the ε-free automaton over the start and the targets of letter transitions, ranked with the
+   start first and the others in the order of their ids; the transitions of rank r are
+   edges[edge_start[r]] up to the start of the next rank, sorted by class and target */
+struct epsilon_free_nfa
+{
+    unsigned int count;
+    unsigned int *order;
+    unsigned int *edge_start;
+    struct ranked_edge *edges;
+    bool *final;
+};
+
+static int compareRankedEdges(const void *a, const void *b)
+{
+    const struct ranked_edge *x = a;
+    const struct ranked_edge *y = b;
+    if (x->k != y->k)
+        return (x->k < y->k) ? -1 : 1;
+    if (x->to != y->to)
+        return (x->to < y->to) ? -1 : 1;
+    return 0;
+}
+
+/* sorts the edges from first to length and drops duplicates, returns the new length */
+static unsigned int sortRankedEdges(struct ranked_edge *edges, unsigned int first, unsigned int length)
+{
+    qsort(edges + first, length - first, sizeof(struct ranked_edge), compareRankedEdges);
+
+    unsigned int kept = first;
+    for (unsigned int e = first; e < length; e++)
+    {
+        if (kept == first || compareRankedEdges(&edges[kept - 1], &edges[e]) != 0)
+            edges[kept++] = edges[e];
+    }
+
+    return kept;
+}
+
+/* a state moves on a letter wherever some state of its ε-closure does and is final when its
+   closure holds a final state; only the start and targets of letter transitions can then be
+   reached, which is where most of the states of the construction drop out */
+static struct epsilon_free_nfa EpsilonFreeNFA(compiled_nfa c)
+{
+    unsigned int n = c->state_count;
+    struct epsilon_free_nfa f;
+    f.order = malloc((n + 1) * sizeof(unsigned int));
+    f.edge_start = malloc((n + 1) * sizeof(unsigned int));
+    f.final = calloc(n + 1, sizeof(bool));
+    unsigned int *rank = malloc((n + 1) * sizeof(unsigned int));
+    unsigned int *closure = malloc((c->components + 1) * sizeof(unsigned int));
+    uint64_t *reached = calloc(c->components / BITS_PER_WORD + 1, sizeof(uint64_t));
+    unsigned int size = n + 1;
+    f.edges = malloc(size * sizeof(struct ranked_edge));
+    assert(f.order != NULL && f.edge_start != NULL && f.final != NULL && rank != NULL && closure != NULL && reached != NULL && f.edges != NULL);
+
+    for (unsigned int s = 0; s < n; s++)
+        rank[s] = NO_COMPILED_STATE;
+    for (unsigned int e = 0; e < c->edges; e++)
+        rank[c->successors[e]] = 0;
+
+    f.count = 0;
+    rank[c->start] = f.count;
+    f.order[f.count++] = c->start;
+    for (unsigned int s = 0; s < n; s++)
+    {
+        if (rank[s] == 0 && s != c->start)
+        {
+            rank[s] = f.count;
+            f.order[f.count++] = s;
+        }
+    }
+
+    unsigned int length = 0;
+    for (unsigned int r = 0; r < f.count; r++)
+    {
+        f.edge_start[r] = length;
+        closure[0] = c->component_of[f.order[r]];
+        addState(reached, closure[0]);
+        unsigned int components = reachVertices(componentGraph(c), reached, closure, 1);
+
+        for (unsigned int j = 0; j < components; j++)
+        {
+            unsigned int k = closure[j];
+            reached[k / BITS_PER_WORD] &= ~((uint64_t)1 << (k % BITS_PER_WORD));
+            for (unsigned int m = c->member_start[k]; m < c->member_start[k + 1]; m++)
+            {
+                unsigned int p = c->members[m];
+                if (hasState(c->final, p))
+                    f.final[r] = true;
+
+                for (unsigned int row = p * c->classes + 1; row < (p + 1) * c->classes; row++)
+                {
+                    for (unsigned int e = c->successor_start[row]; e < c->successor_start[row + 1]; e++)
+                    {
+                        if (length == size)
+                        {
+                            size *= 2;
+                            f.edges = realloc(f.edges, size * sizeof(struct ranked_edge));
+                            assert(f.edges != NULL);
+                        }
+                        f.edges[length].k = row - p * c->classes;
+                        f.edges[length].to = rank[c->successors[e]];
+                        length++;
+                    }
+                }
+            }
+        }
+
+        length = sortRankedEdges(f.edges, f.edge_start[r], length);
+    }
+    f.edge_start[f.count] = length;
+
+    free(reached);
+    free(closure);
+    free(rank);
+    return f;
+}
+
+static void freeEpsilonFreeNFA(struct epsilon_free_nfa *f)
+{
+    free(f->order);
+    free(f->edge_start);
+    free(f->edges);
+    free(f->final);
+}
+
+/* a rank is useful when the start reaches it and it reaches a final rank, searched forward from
+   rank 0 and backward from the final ranks over the moves between ranks */
+static bool *usefulRanks(const struct epsilon_free_nfa *f)
+{
+    unsigned int m = f->count;
+    unsigned int edges = f->edge_start[m];
+    unsigned int *targets = malloc((edges + 1) * sizeof(unsigned int));
+    unsigned int *source_start = calloc(m + 2, sizeof(unsigned int));
+    unsigned int *sources = malloc((edges + 1) * sizeof(unsigned int));
+    unsigned int *queue = malloc((m + 1) * sizeof(unsigned int));
+    uint64_t *reachable = calloc(m / BITS_PER_WORD + 1, sizeof(uint64_t));
+    uint64_t *coreachable = calloc(m / BITS_PER_WORD + 1, sizeof(uint64_t));
+    bool *useful = calloc(m + 1, sizeof(bool));
+    assert(targets != NULL && source_start != NULL && sources != NULL && queue != NULL && reachable != NULL && coreachable != NULL && useful != NULL);
+
+    for (unsigned int e = 0; e < edges; e++)
+    {
+        targets[e] = f->edges[e].to;
+        source_start[targets[e] + 2]++;
+    }
+    for (unsigned int r = 0; r < m; r++)
+        source_start[r + 2] += source_start[r + 1];
+    for (unsigned int r = 0; r < m; r++)
+    {
+        for (unsigned int e = f->edge_start[r]; e < f->edge_start[r + 1]; e++)
+            sources[source_start[targets[e] + 1]++] = r;
+    }
+
+    graph moves = {m, f->edge_start, targets};
+    queue[0] = 0;
+    addState(reachable, 0);
+    (void)reachVertices(moves, reachable, queue, 1);
+
+    graph inverse = {m, source_start, sources};
+    unsigned int tail = 0;
+    for (unsigned int r = 0; r < m; r++)
+    {
+        if (f->final[r])
+        {
+            addState(coreachable, r);
+            queue[tail++] = r;
+        }
+    }
+    (void)reachVertices(inverse, coreachable, queue, tail);
+
+    for (unsigned int r = 0; r < m; r++)
+        useful[r] = hasState(reachable, r) && hasState(coreachable, r);
+
+    free(targets);
+    free(source_start);
+    free(sources);
+    free(queue);
+    free(reachable);
+    free(coreachable);
+    return useful;
+}
+
+/* the transitions of a rank as (class, block of target) pairs, sorted and without duplicates */
+struct signatures
+{
+    unsigned int *start;
+    struct ranked_edge *pairs;
+};
+
+static bool haveSameSignature(const struct signatures *g, const unsigned int *block, unsigned int a, unsigned int b)
+{
+    if (block[a] != block[b] || g->start[a + 1] - g->start[a] != g->start[b + 1] - g->start[b])
+        return false;
+
+    unsigned int length = g->start[a + 1] - g->start[a];
+    return length == 0 || memcmp(g->pairs + g->start[a], g->pairs + g->start[b], length * sizeof(struct ranked_edge)) == 0;
+}
+
+static uint64_t hashSignature(const struct signatures *g, const unsigned int *block, unsigned int r)
+{
+    uint64_t h = block[r] * 0x9e3779b97f4a7c15ULL;
+    for (unsigned int e = g->start[r]; e < g->start[r + 1]; e++)
+    {
+        h = (h ^ g->pairs[e].k) * 0x100000001b3ULL;
+        h = (h ^ g->pairs[e].to) * 0x100000001b3ULL;
+    }
+
+    return h ^ (h >> 32);
+}
+
+/* coarsest partition of the useful ranks in which ranks of one block agree on finality and move
+   on every class into the same blocks, refined until no block splits any more; returns the
+   number of blocks, unused ranks get NO_COMPILED_STATE */
+static unsigned int mergeEquivalentRanks(const struct epsilon_free_nfa *f, const bool *useful, unsigned int *block)
+{
+    unsigned int m = f->count;
+    unsigned int edges = f->edge_start[m];
+    struct signatures g;
+    g.start = malloc((m + 1) * sizeof(unsigned int));
+    g.pairs = malloc((edges + 1) * sizeof(struct ranked_edge));
+    unsigned int *next = malloc((m + 1) * sizeof(unsigned int));
+    unsigned int size = 1;
+    while (size < 2 * m + 1)
+        size *= 2;
+    unsigned int *slots = malloc(size * sizeof(unsigned int));
+    assert(g.start != NULL && g.pairs != NULL && next != NULL && slots != NULL);
+
+    unsigned int blocks = 0;
+    bool final_block = false;
+    bool other_block = false;
+    for (unsigned int r = 0; r < m; r++)
+    {
+        block[r] = !useful[r] ? NO_COMPILED_STATE : (f->final[r] ? 1 : 0);
+        if (useful[r])
+        {
+            final_block |= f->final[r];
+            other_block |= !f->final[r];
+        }
+    }
+    blocks = (unsigned int)final_block + (unsigned int)other_block;
+
+    for (;;)
+    {
+        unsigned int length = 0;
+        for (unsigned int r = 0; r < m; r++)
+        {
+            g.start[r] = length;
+            if (!useful[r])
+                continue;
+
+            unsigned int first = length;
+            for (unsigned int e = f->edge_start[r]; e < f->edge_start[r + 1]; e++)
+            {
+                if (!useful[f->edges[e].to])
+                    continue;
+                g.pairs[length].k = f->edges[e].k;
+                g.pairs[length].to = block[f->edges[e].to];
+                length++;
+            }
+            length = sortRankedEdges(g.pairs, first, length);
+        }
+        g.start[m] = length;
+
+        unsigned int refined = 0;
+        memset(slots, 0xff, size * sizeof(unsigned int));
+        for (unsigned int r = 0; r < m; r++)
+        {
+            next[r] = NO_COMPILED_STATE;
+            if (!useful[r])
+                continue;
+
+            unsigned int i = (unsigned int)hashSignature(&g, block, r) & (size - 1);
+            while (slots[i] != NO_COMPILED_STATE && !haveSameSignature(&g, block, slots[i], r))
+                i = (i + 1) & (size - 1);
+
+            if (slots[i] == NO_COMPILED_STATE)
+            {
+                slots[i] = r;
+                next[r] = refined++;
+            }
+            else
+            {
+                next[r] = next[slots[i]];
+            }
+        }
+
+        memcpy(block, next, m * sizeof(unsigned int));
+        if (refined == blocks)
+            break;
+        blocks = refined;
+    }
+
+    free(g.start);
+    free(g.pairs);
+    free(next);
+    free(slots);
+    return blocks;
+}
+
+/* each block is named after its first rank, which is the start for the block holding it; a
+   transition on a class stands for one on each of its letters */
+n_tuple optimizeCompiledNFA(compiled_nfa c)
+{
+    set alphabet = getObjectByIndex(c->nfa, 1);
+    unsigned int *letter_start = calloc(c->classes + 1, sizeof(unsigned int));
+    letter *class_letters = malloc((getCardinality(alphabet) + 1) * sizeof(letter));
+    assert(letter_start != NULL && class_letters != NULL);
+    for (set_iterator i = SetIterator(alphabet); hasNextElement(&i);)
+        letter_start[classOf(c, getLetterCode(nextElement(&i)))]++;
+    for (unsigned int k = 1; k <= c->classes; k++)
+        letter_start[k] += letter_start[k - 1];
+    for (set_iterator i = SetIterator(alphabet); hasNextElement(&i);)
+    {
+        letter let = nextElement(&i);
+        class_letters[--letter_start[classOf(c, getLetterCode(let))]] = let;
+    }
+
+    struct epsilon_free_nfa f = EpsilonFreeNFA(c);
+    bool *useful = usefulRanks(&f);
+    unsigned int *block = malloc((f.count + 1) * sizeof(unsigned int));
+    assert(block != NULL);
+    unsigned int blocks = mergeEquivalentRanks(&f, useful, block);
+
+    word *names = calloc(blocks + 1, sizeof(word));
+    assert(names != NULL);
+    for (unsigned int r = 0; r < f.count; r++)
+    {
+        if (block[r] != NO_COMPILED_STATE && names[block[r]] == NULL)
+            names[block[r]] = c->states[f.order[r]];
+    }
+
+    /* the start is kept even when it is not useful, so with no final state in reach the result
+       is the start alone, accepting nothing */
+    word start = c->states[c->start];
+    set_builder states = SetBuilder();
+    set_builder final_states = SetBuilder();
+    set_builder delta_relation = SetBuilder();
+    addToSetBuilder(states, start);
+
+    bool *named = calloc(blocks + 1, sizeof(bool));
+    assert(named != NULL);
+    for (unsigned int r = 0; r < f.count; r++)
+    {
+        if (block[r] == NO_COMPILED_STATE || named[block[r]])
+            continue;
+        named[block[r]] = true;
+
+        word state = names[block[r]];
+        addToSetBuilder(states, state);
+        if (f.final[r])
+            addToSetBuilder(final_states, state);
+
+        for (unsigned int e = f.edge_start[r]; e < f.edge_start[r + 1]; e++)
+        {
+            unsigned int to = block[f.edges[e].to];
+            if (to == NO_COMPILED_STATE)
+                continue;
+            unsigned int k = f.edges[e].k;
+            for (unsigned int j = letter_start[k]; j < letter_start[k + 1]; j++)
+                addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), class_letters[j]), addToSet(Set(), names[to]));
+        }
+    }
+
+    nfa_delta_function delta = relationToNFADeltaFunction(buildSet(delta_relation));
+    n_tuple optimized = NTuple(5, buildSet(states), alphabet, delta, start, buildSet(final_states));
+
+    free(named);
+    free(names);
+    free(block);
+    free(useful);
+    freeEpsilonFreeNFA(&f);
+    free(class_letters);
+    free(letter_start);
+    return optimized;
+}
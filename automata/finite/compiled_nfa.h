@@ -0,0 +1,42 @@
+#ifndef COMPILED_NFA_H
+#define COMPILED_NFA_H
+
+#include "n_tuple.h"
+#include "letter.h"
+#include "word.h"
+#include <stdint.h>
+
+#define NO_COMPILED_STATE ((unsigned int)-1)
+
+typedef const struct compiled_nfa_ *compiled_nfa;
+
+/* a simulation of a compiled nfa, states and next are bitsets over the state ids; components
+   marks the ε-components a step enters and queue holds them in the order they were entered */
+typedef struct compiled_nfa_run_
+{
+    compiled_nfa nfa;
+    uint64_t *states;
+    uint64_t *next;
+    uint64_t *components;
+    unsigned int *queue;
+    unsigned int active;
+} compiled_nfa_run;
+
+compiled_nfa compileNFA(n_tuple nfa);
+n_tuple getCompiledNFATuple(compiled_nfa c);
+unsigned int getCompiledStateCount(compiled_nfa c);
+word getCompiledState(compiled_nfa c, unsigned int id);
+unsigned int getCompiledStateId(compiled_nfa c, word state);
+unsigned int getCompiledStart(compiled_nfa c);
+unsigned int getCompiledClassCount(compiled_nfa c);
+bool isCompiledStateFinal(compiled_nfa c, unsigned int id);
+n_tuple optimizeCompiledNFA(compiled_nfa c);
+
+compiled_nfa_run CompiledNFARun(compiled_nfa c);
+void stepCompiledNFARun(compiled_nfa_run *r, letter let);
+void stepCompiledNFARunByCode(compiled_nfa_run *r, unsigned int code);
+bool isCompiledNFARunAccepting(const compiled_nfa_run *r);
+void freeCompiledNFARun(compiled_nfa_run *r);
+bool runCompiledNFA(compiled_nfa c, packed_word input);
+
+#endif // COMPILED_NFA_H
@@ -1,66 +1,59 @@
 #include "nfa_delta_function.h"
 #include "n_tuple.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 nfa_delta_function NFADeltaFunction(void)
 {
     return Function();
 }
 
-nfa_delta_function relationToNFADeltaFunction(relation delta_relation)
+struct delta_entry
 {
-    nfa_delta_function delta = NFADeltaFunction();
-    for (unsigned int i = 0; i < getCardinality(delta_relation); i++)
-    {
-        n_tuple tuple = drawFromSet(delta_relation);
-        set from = getObjectByIndex(tuple, 0);
-
-        word state = getWordFromNFADeltaFunctionDomainElement(from);
-        letter let = getLetterFromNFADeltaFunctionDomainElement(from);
-
-        set new_to = Set();
-        for (unsigned int j = 0; j < getCardinality(delta_relation); j++)
-        {
-            n_tuple tuple2 = drawFromSet(delta_relation);
-            set from2 = getObjectByIndex(tuple2, 0);
-            set to2 = getObjectByIndex(tuple2, 1);
+    set from;
+    set to;
+};
 
-            word state2 = getWordFromNFADeltaFunctionDomainElement(from2);
-            letter let2 = getLetterFromNFADeltaFunctionDomainElement(from2);
-
-            if (state == state2 && let == let2)
-                new_to = unionSet(new_to, to2);
-        }
+static int compareDeltaEntries(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const struct delta_entry *)a)->from;
+    uintptr_t y = (uintptr_t)((const struct delta_entry *)b)->from;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
 
-        delta = addToNFADeltaFunction(delta, state, let, new_to);
+nfa_delta_function relationToNFADeltaFunction(relation delta_relation)
+{
+    /* identical {state, letter} domain elements are the same interned set, so sorting the
+       pairs by that pointer groups every target set of one transition together */
+    unsigned int n = getCardinality(delta_relation);
+    struct delta_entry *entries = malloc((n + 1) * sizeof(struct delta_entry));
+    assert(entries != NULL);
+
+    unsigned int k = 0;
+    for (set_iterator i = SetIterator(delta_relation); hasNextElement(&i);)
+    {
+        n_tuple tuple = nextElement(&i);
+        entries[k].from = getObjectByIndex(tuple, 0);
+        entries[k].to = getObjectByIndex(tuple, 1);
+        k++;
     }
+    qsort(entries, n, sizeof(struct delta_entry), compareDeltaEntries);
 
-    for (unsigned int i = 0; i < getCardinality(delta_relation); i++)
+    set_builder delta = SetBuilder();
+    for (unsigned int i = 0; i < n;)
     {
-        n_tuple tuple = drawFromSet(delta_relation);
-        set from = getObjectByIndex(tuple, 0);
-        set to = getObjectByIndex(tuple, 1);
-
-        word state = getWordFromNFADeltaFunctionDomainElement(from);
-        letter let = getLetterFromNFADeltaFunctionDomainElement(from);
-
-        bool exists = false;
-        for (unsigned int j = 0; j < getCardinality(delta); j++)
+        set from = entries[i].from;
+        set_builder to = SetBuilder();
+        for (; i < n && entries[i].from == from; i++)
         {
-            n_tuple tuple2 = drawFromSet(delta);
-            set from2 = getObjectByIndex(tuple2, 0);
-
-            word state2 = getWordFromNFADeltaFunctionDomainElement(from2);
-            letter let2 = getLetterFromNFADeltaFunctionDomainElement(from2);
-
-            if (state == state2 && let == let2)
-                exists = true;
+            addSetToSetBuilder(to, entries[i].to);
         }
-
-        if (!exists)
-            delta = addToNFADeltaFunction(delta, state, let, to);
+        addToRelationBuilder(delta, from, buildSet(to));
     }
+    free(entries);
 
-    return delta;
+    return buildSet(delta);
 }
 
 nfa_delta_function addToNFADeltaFunction(nfa_delta_function f, word w, letter let, set to)
@@ -79,26 +72,26 @@ set getNFADeltaFunctionValue(nfa_delta_function f, word w, letter let)
 
 word getWordFromNFADeltaFunctionDomainElement(set from)
 {
-    void *firstDrawFrom = drawFromSet(from);
-    if (isObjectAnOrderedPair(firstDrawFrom))
+    void *const *elements = getElements(from);
+    if (getObjectKind(elements[0]) == OBJECT_WORD)
     {
-        return firstDrawFrom;
+        return elements[0];
     }
     else
     {
-        return drawFromSet(from);
+        return elements[1];
     }
 }
 
 letter getLetterFromNFADeltaFunctionDomainElement(set from)
 {
-    void *firstDrawFrom = drawFromSet(from);
-    if (isObjectAnOrderedPair(firstDrawFrom))
+    void *const *elements = getElements(from);
+    if (getObjectKind(elements[0]) == OBJECT_WORD)
     {
-        return drawFromSet(from);
+        return elements[1];
     }
     else
     {
-        return firstDrawFrom;
+        return elements[0];
     }
 }
\ No newline at end of file
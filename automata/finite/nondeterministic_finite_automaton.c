@@ -1,135 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "nondeterministic_finite_automaton.h"
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static set consumeLetter(nondeterministic_finite_automaton nfa, set states, letter let)
-{
-    nfa_delta_function delta = getObjectByIndex(nfa, 2);
-    set new_states = Set();
-    for (unsigned int i = 0; i < getCardinality(states); i++)
-    {
-        word state = drawFromSet(states);
-        set to = getNFADeltaFunctionValue(delta, state, let);
-        if (to != NULL)
-            new_states = unionSet(new_states, to);
-    }
-    return new_states;
-}
+#define NFA_STREAM_CHUNK_SIZE 65536
+#define NFA_PRINT_BUFFER_SIZE 65536
 
-static set epsilonClosure(nondeterministic_finite_automaton nfa, set states)
-{
-    if (getCardinality(states) == 0)
-        return states;
-
-    nfa_delta_function delta = getObjectByIndex(nfa, 2);
-    set new_states = Set();
-    for (unsigned int i = 0; i < getCardinality(states); i++)
-    {
-        word state = drawFromSet(states);
-        set to = getNFADeltaFunctionValue(delta, state, letter_epsilon);
-        if (to != NULL)
-            new_states = unionSet(new_states, to);
-    }
-
-    new_states = unionSet(new_states, epsilonClosure(nfa, new_states));
-
-    return unionSet(states, new_states);
-}
-
-void printNFA(nondeterministic_finite_automaton nfa)
+void printNFAToBuffer(print_buffer *b, nondeterministic_finite_automaton nfa)
 {
     set states = getObjectByIndex(nfa, 0);
-    print(L"Q = {");
-    for (unsigned int i = 0; i < getCardinality(states); i++)
+    printToBuffer(b, L"Q = {");
+    for (set_iterator i = SetIterator(states); hasNextElement(&i);)
     {
-        word state = drawFromSet(states);
-        print(L"%lw", state);
-        if (i < getCardinality(states) - 1)
-            print(L", ");
+        word state = nextElement(&i);
+        printToBuffer(b, L"%lw", state);
+        if (hasNextElement(&i))
+            printToBuffer(b, L", ");
     }
-    print(L"}\n");
+    printToBuffer(b, L"}\n");
 
     set alphabet = getObjectByIndex(nfa, 1);
-    print(L"Σ = {");
-    for (unsigned int i = 0; i < getCardinality(alphabet); i++)
+    printToBuffer(b, L"Σ = {");
+    for (set_iterator i = SetIterator(alphabet); hasNextElement(&i);)
     {
-        letter let = drawFromSet(alphabet);
-        print(L"%ll", let);
-        if (i < getCardinality(alphabet) - 1)
-            print(L", ");
+        letter let = nextElement(&i);
+        printToBuffer(b, L"%ll", let);
+        if (hasNextElement(&i))
+            printToBuffer(b, L", ");
     }
-    print(L"}\n");
+    printToBuffer(b, L"}\n");
 
     nfa_delta_function delta = getObjectByIndex(nfa, 2);
-    print(L"δ = {\n");
-    for (unsigned int i = 0; i < getCardinality(delta); i++)
+    printToBuffer(b, L"δ = {\n");
+    for (set_iterator i = SetIterator(delta); hasNextElement(&i);)
     {
-        n_tuple tuple = drawFromSet(delta);
+        n_tuple tuple = nextElement(&i);
         set from = getObjectByIndex(tuple, 0);
         word state = getWordFromNFADeltaFunctionDomainElement(from);
         letter let = getLetterFromNFADeltaFunctionDomainElement(from);
         set to = getObjectByIndex(tuple, 1);
 
-        print(L"    ({%lw, %ll}, {", state, let);
-        for (unsigned int j = 0; j < getCardinality(to); j++)
+        printToBuffer(b, L"    ({%lw, %ll}, {", state, let);
+        for (set_iterator j = SetIterator(to); hasNextElement(&j);)
         {
-            word next_state = drawFromSet(to);
-            print(L"%lw", next_state);
-            if (j < getCardinality(to) - 1)
-                print(L", ");
+            word next_state = nextElement(&j);
+            printToBuffer(b, L"%lw", next_state);
+            if (hasNextElement(&j))
+                printToBuffer(b, L", ");
         }
-        print(L"})");
-        if (i < getCardinality(delta) - 1)
-            print(L",\n");
+        printToBuffer(b, L"})");
+        if (hasNextElement(&i))
+            printToBuffer(b, L",\n");
     }
 
-    print(L"\n}\n");
+    printToBuffer(b, L"\n}\n");
 
     word start = getObjectByIndex(nfa, 3);
-    print(L"q = %lw\n", start);
+    printToBuffer(b, L"q = %lw\n", start);
 
     set final_states = getObjectByIndex(nfa, 4);
-    print(L"F = {");
-    for (unsigned int i = 0; i < getCardinality(final_states); i++)
+    printToBuffer(b, L"F = {");
+    for (set_iterator i = SetIterator(final_states); hasNextElement(&i);)
     {
-        word state = drawFromSet(final_states);
-        print(L"%lw", state);
-        if (i < getCardinality(final_states) - 1)
-            print(L", ");
+        word state = nextElement(&i);
+        printToBuffer(b, L"%lw", state);
+        if (hasNextElement(&i))
+            printToBuffer(b, L", ");
     }
-    print(L"}\n");
+    printToBuffer(b, L"}\n");
+}
+
+void printNFA(nondeterministic_finite_automaton nfa)
+{
+    wchar_t *data = malloc(NFA_PRINT_BUFFER_SIZE * sizeof(wchar_t));
+    assert(data != NULL);
+
+    print_buffer b = PrintBuffer(stdout, data, NFA_PRINT_BUFFER_SIZE);
+    printNFAToBuffer(&b, nfa);
+    flushPrintBuffer(&b);
+
+    free(data);
 }
 
 bool runNFA(nondeterministic_finite_automaton nfa, void *inp)
 {
-    word start = getObjectByIndex(nfa, 3);
-    set states = epsilonClosure(nfa, addToSet(Set(), start));
+    compiled_nfa c = compileNFA(nfa);
+    if (inp != NULL && getObjectKind(inp) == OBJECT_WORD)
+        return runCompiledNFA(c, PackedWord(inp));
 
+    compiled_nfa_run r = CompiledNFARun(c);
     if (inp != NULL)
+        stepCompiledNFARun(&r, inp);
+
+    bool accepted = isCompiledNFARunAccepting(&r);
+    freeCompiledNFARun(&r);
+    return accepted;
+}
+
+nfa_matcher NFAMatcher(nondeterministic_finite_automaton nfa)
+{
+    nfa_matcher m;
+    m.run = CompiledNFARun(compileNFA(nfa));
+    m.pending_length = 0;
+    return m;
+}
+
+/* input only looks letters up, so it never grows the letter table; a code point that is not
+   a letter yet is in no alphabet and leaves the run without states */
+static void stepNFAMatcher(nfa_matcher *m, unsigned int code_point)
+{
+    if (code_point > MAX_CODE_POINT)
+        code_point = REPLACEMENT_CHARACTER;
+
+    stepCompiledNFARun(&m->run, findLetter(code_point));
+}
+
+/* a sequence cut off by the end of the piece that the next piece could still complete */
+static bool isTruncatedUTF8(const unsigned char *bytes, size_t length)
+{
+    if (getUTF8SequenceLength(bytes[0]) <= length)
+        return false;
+
+    for (size_t k = 1; k < length; k++)
+    {
+        if ((bytes[k] & 0xC0) != 0x80)
+            return false;
+    }
+    return true;
+}
+
+static void holdPending(nfa_matcher *m, const unsigned char *bytes, size_t length)
+{
+    memcpy(m->pending, bytes, length);
+    m->pending_length = (unsigned int)length;
+}
+
+void feedNFAMatcher(nfa_matcher *m, const char *bytes, size_t length)
+{
+    const unsigned char *b = (const unsigned char *)bytes;
+    size_t i = 0;
+
+    /* finish the sequences that started in the previous piece on a few borrowed bytes */
+    if (m->pending_length > 0)
     {
-        if (isObjectAnOrderedPair(inp))
+        unsigned char joined[8];
+        size_t carried = m->pending_length;
+        size_t borrowed = (length < 4) ? length : 4;
+        memcpy(joined, m->pending, carried);
+        memcpy(joined + carried, b, borrowed);
+        m->pending_length = 0;
+
+        size_t j = 0;
+        while (j < carried)
         {
-            for (unsigned int i = 0; i < getLength(inp); i++)
+            if (borrowed == length && isTruncatedUTF8(joined + j, carried + borrowed - j))
             {
-                letter let = getLetterByIndex(inp, i);
-                states = consumeLetter(nfa, states, let);
-                states = epsilonClosure(nfa, states);
+                holdPending(m, joined + j, carried + borrowed - j);
+                return;
             }
+            stepNFAMatcher(m, decodeUTF8(joined, carried + borrowed, &j));
         }
-        else
+        i = j - carried;
+    }
+
+    while (i < length)
+    {
+        if (isTruncatedUTF8(b + i, length - i))
         {
-            states = consumeLetter(nfa, states, inp);
-            states = epsilonClosure(nfa, states);
+            holdPending(m, b + i, length - i);
+            return;
         }
+        stepNFAMatcher(m, decodeUTF8(b, length, &i));
     }
+}
 
-    set final_states = getObjectByIndex(nfa, 4);
-    for (unsigned int i = 0; i < getCardinality(final_states); i++)
+void feedNFAMatcherBytes(nfa_matcher *m, const unsigned char *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
     {
-        word state = drawFromSet(final_states);
-        if (isElementOf(states, state))
-            return true;
+        stepNFAMatcher(m, bytes[i]);
     }
-    return false;
+}
+
+void feedNFAMatcherWide(nfa_matcher *m, const wchar_t *str, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        stepNFAMatcher(m, (unsigned int)str[i]);
+    }
+}
+
+bool finishNFAMatcher(nfa_matcher *m)
+{
+    /* whatever is still pending was never completed, so each byte of it is malformed */
+    size_t i = 0;
+    while (i < m->pending_length)
+    {
+        stepNFAMatcher(m, decodeUTF8(m->pending, m->pending_length, &i));
+    }
+    m->pending_length = 0;
+
+    bool accepted = isCompiledNFARunAccepting(&m->run);
+    freeCompiledNFARun(&m->run);
+    return accepted;
+}
+
+bool runNFAOnBuffer(nondeterministic_finite_automaton nfa, const char *bytes, size_t length)
+{
+    nfa_matcher m = NFAMatcher(nfa);
+    feedNFAMatcher(&m, bytes, length);
+    return finishNFAMatcher(&m);
+}
+
+static nfa_result finishNFAMatcherWithResult(nfa_matcher *m, bool failed)
+{
+    bool accepted = finishNFAMatcher(m);
+    if (failed)
+        return NFA_READ_ERROR;
+    return accepted ? NFA_ACCEPTED : NFA_REJECTED;
+}
+
+/* an interrupted read is retried, any other error ends the run with NFA_READ_ERROR and errno
+   set by the failed read */
+nfa_result runNFAOnFile(nondeterministic_finite_automaton nfa, FILE *file)
+{
+    char *chunk = malloc(NFA_STREAM_CHUNK_SIZE);
+    assert(chunk != NULL);
+
+    nfa_matcher m = NFAMatcher(nfa);
+    bool failed = false;
+    for (;;)
+    {
+        size_t n = fread(chunk, 1, NFA_STREAM_CHUNK_SIZE, file);
+        feedNFAMatcher(&m, chunk, n);
+        if (n == NFA_STREAM_CHUNK_SIZE)
+            continue;
+        if (!ferror(file))
+            break;
+        if (errno != EINTR)
+        {
+            failed = true;
+            break;
+        }
+        clearerr(file);
+    }
+
+    free(chunk);
+    return finishNFAMatcherWithResult(&m, failed);
+}
+
+nfa_result runNFAOnDescriptor(nondeterministic_finite_automaton nfa, int fd)
+{
+    char *chunk = malloc(NFA_STREAM_CHUNK_SIZE);
+    assert(chunk != NULL);
+
+    nfa_matcher m = NFAMatcher(nfa);
+    bool failed = false;
+    ssize_t n;
+    while ((n = read(fd, chunk, NFA_STREAM_CHUNK_SIZE)) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            failed = true;
+            break;
+        }
+        feedNFAMatcher(&m, chunk, (size_t)n);
+    }
+
+    free(chunk);
+    return finishNFAMatcherWithResult(&m, failed);
+}
+
+/* falls back to reading for anything that cannot be mapped, such as pipes */
+nfa_result runNFAOnMappedFile(nondeterministic_finite_automaton nfa, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return runNFAOnDescriptor(nfa, fd);
+
+    size_t length = (size_t)st.st_size;
+    void *bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (bytes == MAP_FAILED)
+        return runNFAOnDescriptor(nfa, fd);
+    (void)posix_madvise(bytes, length, POSIX_MADV_SEQUENTIAL);
+
+    bool accepted = runNFAOnBuffer(nfa, bytes, length);
+
+    munmap(bytes, length);
+    return accepted ? NFA_ACCEPTED : NFA_REJECTED;
 }
 
 nondeterministic_finite_automaton NondeterministicFiniteAutomaton(set states, set alphabet, nfa_delta_function delta, word start, set final_states)
@@ -180,36 +346,28 @@ nondeterministic_finite_automaton concatinationNFA(nondeterministic_finite_autom
     word start_right = getObjectByIndex(nfa_right, 3);
     set final_states_right = getObjectByIndex(nfa_right, 4);
 
-    set states = Set();
-    for (unsigned int i = 0; i < getCardinality(states_left); i++)
+    set_builder states = SetBuilder();
+    for (set_iterator i = SetIterator(states_left); hasNextElement(&i);)
     {
-        word state = drawFromSet(states_left);
+        word state = nextElement(&i);
         state = Word(2, state, letter_l);
-        states = addToSet(states, state);
+        addToSetBuilder(states, state);
     }
-    for (unsigned int i = 0; i < getCardinality(states_right); i++)
+    for (set_iterator i = SetIterator(states_right); hasNextElement(&i);)
     {
-        word state = drawFromSet(states_right);
+        word state = nextElement(&i);
         state = Word(2, state, letter_r);
-        states = addToSet(states, state);
+        addToSetBuilder(states, state);
     }
 
-    set alphabet = Set();
-    for (unsigned int i = 0; i < getCardinality(alphabet_left); i++)
-    {
-        letter let = drawFromSet(alphabet_left);
-        alphabet = addToSet(alphabet, let);
-    }
-    for (unsigned int i = 0; i < getCardinality(alphabet_right); i++)
-    {
-        letter let = drawFromSet(alphabet_right);
-        alphabet = addToSet(alphabet, let);
-    }
+    set_builder alphabet = SetBuilder();
+    addSetToSetBuilder(alphabet, alphabet_left);
+    addSetToSetBuilder(alphabet, alphabet_right);
 
-    relation delta_relation = Relation();
-    for (unsigned int i = 0; i < getCardinality(delta_left); i++)
+    set_builder delta_relation = SetBuilder();
+    for (set_iterator i = SetIterator(delta_left); hasNextElement(&i);)
     {
-        n_tuple tuple = drawFromSet(delta_left);
+        n_tuple tuple = nextElement(&i);
         set from = getObjectByIndex(tuple, 0);
         set to = getObjectByIndex(tuple, 1);
 
@@ -217,16 +375,16 @@ nondeterministic_finite_automaton concatinationNFA(nondeterministic_finite_autom
         state = Word(2, state, letter_l);
         letter let = getLetterFromNFADeltaFunctionDomainElement(from);
 
-        for (unsigned int j = 0; j < getCardinality(to); j++)
+        for (set_iterator j = SetIterator(to); hasNextElement(&j);)
         {
-            word next_state = drawFromSet(to);
+            word next_state = nextElement(&j);
             next_state = Word(2, next_state, letter_l);
-            delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
+            addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
         }
     }
-    for (unsigned int i = 0; i < getCardinality(delta_right); i++)
+    for (set_iterator i = SetIterator(delta_right); hasNextElement(&i);)
     {
-        n_tuple tuple = drawFromSet(delta_right);
+        n_tuple tuple = nextElement(&i);
         set from = getObjectByIndex(tuple, 0);
         set to = getObjectByIndex(tuple, 1);
 
@@ -234,38 +392,38 @@ nondeterministic_finite_automaton concatinationNFA(nondeterministic_finite_autom
         state = Word(2, state, letter_r);
         letter let = getLetterFromNFADeltaFunctionDomainElement(from);
 
-        for (unsigned int j = 0; j < getCardinality(to); j++)
+        for (set_iterator j = SetIterator(to); hasNextElement(&j);)
         {
-            word next_state = drawFromSet(to);
+            word next_state = nextElement(&j);
             next_state = Word(2, next_state, letter_r);
-            delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
+            addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
         }
     }
 
     word start = Word(2, letter_q, letter_0);
     word final_state = Word(2, letter_q, letter_1);
-    states = addToSet(states, start);
-    states = addToSet(states, final_state);
+    addToSetBuilder(states, start);
+    addToSetBuilder(states, final_state);
 
-    delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_left, letter_l)));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_left, letter_l)));
 
-    for (unsigned int i = 0; i < getCardinality(final_states_left); i++)
+    for (set_iterator i = SetIterator(final_states_left); hasNextElement(&i);)
     {
-        word state = drawFromSet(final_states_left);
+        word state = nextElement(&i);
         state = Word(2, state, letter_l);
-        delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), Word(2, start_right, letter_r)));
+        addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), Word(2, start_right, letter_r)));
     }
 
-    for (unsigned int i = 0; i < getCardinality(final_states_right); i++)
+    for (set_iterator i = SetIterator(final_states_right); hasNextElement(&i);)
     {
-        word state = drawFromSet(final_states_right);
+        word state = nextElement(&i);
         state = Word(2, state, letter_r);
-        delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
+        addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
     }
 
-    function delta = relationToNFADeltaFunction(delta_relation);
+    function delta = relationToNFADeltaFunction(buildSet(delta_relation));
 
-    return NondeterministicFiniteAutomaton(states, alphabet, delta, start, addToSet(Set(), final_state));
+    return NondeterministicFiniteAutomaton(buildSet(states), buildSet(alphabet), delta, start, addToSet(Set(), final_state));
 }
 
 nondeterministic_finite_automaton unionNFA(nondeterministic_finite_automaton nfa_left, nondeterministic_finite_automaton nfa_right)
@@ -289,36 +447,28 @@ nondeterministic_finite_automaton unionNFA(nondeterministic_finite_automaton nfa
     word start_right = getObjectByIndex(nfa_right, 3);
     set final_states_right = getObjectByIndex(nfa_right, 4);
 
-    set states = Set();
-    for (unsigned int i = 0; i < getCardinality(states_left); i++)
+    set_builder states = SetBuilder();
+    for (set_iterator i = SetIterator(states_left); hasNextElement(&i);)
     {
-        word state = drawFromSet(states_left);
+        word state = nextElement(&i);
         state = Word(2, state, letter_l);
-        states = addToSet(states, state);
+        addToSetBuilder(states, state);
     }
-    for (unsigned int i = 0; i < getCardinality(states_right); i++)
+    for (set_iterator i = SetIterator(states_right); hasNextElement(&i);)
     {
-        word state = drawFromSet(states_right);
+        word state = nextElement(&i);
         state = Word(2, state, letter_r);
-        states = addToSet(states, state);
+        addToSetBuilder(states, state);
     }
 
-    set alphabet = Set();
-    for (unsigned int i = 0; i < getCardinality(alphabet_left); i++)
-    {
-        letter let = drawFromSet(alphabet_left);
-        alphabet = addToSet(alphabet, let);
-    }
-    for (unsigned int i = 0; i < getCardinality(alphabet_right); i++)
-    {
-        letter let = drawFromSet(alphabet_right);
-        alphabet = addToSet(alphabet, let);
-    }
+    set_builder alphabet = SetBuilder();
+    addSetToSetBuilder(alphabet, alphabet_left);
+    addSetToSetBuilder(alphabet, alphabet_right);
 
-    relation delta_relation = Relation();
-    for (unsigned int i = 0; i < getCardinality(delta_left); i++)
+    set_builder delta_relation = SetBuilder();
+    for (set_iterator i = SetIterator(delta_left); hasNextElement(&i);)
     {
-        n_tuple tuple = drawFromSet(delta_left);
+        n_tuple tuple = nextElement(&i);
         set from = getObjectByIndex(tuple, 0);
         set to = getObjectByIndex(tuple, 1);
 
@@ -326,17 +476,17 @@ nondeterministic_finite_automaton unionNFA(nondeterministic_finite_automaton nfa
         state = Word(2, state, letter_l);
         letter let = getLetterFromNFADeltaFunctionDomainElement(from);
 
-        for (unsigned int j = 0; j < getCardinality(to); j++)
+        for (set_iterator j = SetIterator(to); hasNextElement(&j);)
         {
-            word next_state = drawFromSet(to);
+            word next_state = nextElement(&j);
             next_state = Word(2, next_state, letter_l);
 
-            delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
+            addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
         }
     }
-    for (unsigned int i = 0; i < getCardinality(delta_right); i++)
+    for (set_iterator i = SetIterator(delta_right); hasNextElement(&i);)
     {
-        n_tuple tuple = drawFromSet(delta_right);
+        n_tuple tuple = nextElement(&i);
         set from = getObjectByIndex(tuple, 0);
         set to = getObjectByIndex(tuple, 1);
 
@@ -344,40 +494,40 @@ nondeterministic_finite_automaton unionNFA(nondeterministic_finite_automaton nfa
         state = Word(2, state, letter_r);
         letter let = getLetterFromNFADeltaFunctionDomainElement(from);
 
-        for (unsigned int j = 0; j < getCardinality(to); j++)
+        for (set_iterator j = SetIterator(to); hasNextElement(&j);)
         {
-            word next_state = drawFromSet(to);
+            word next_state = nextElement(&j);
             next_state = Word(2, next_state, letter_r);
 
-            delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
+            addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
         }
     }
 
     word start = Word(2, letter_q, letter_0);
     word final_state = Word(2, letter_q, letter_1);
-    states = addToSet(states, start);
-    states = addToSet(states, final_state);
+    addToSetBuilder(states, start);
+    addToSetBuilder(states, final_state);
 
-    delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_left, letter_l)));
-    delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_right, letter_r)));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_left, letter_l)));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_right, letter_r)));
 
-    for (unsigned int i = 0; i < getCardinality(final_states_left); i++)
+    for (set_iterator i = SetIterator(final_states_left); hasNextElement(&i);)
     {
-        word state = drawFromSet(final_states_left);
+        word state = nextElement(&i);
         state = Word(2, state, letter_l);
-        delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
+        addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
     }
 
-    for (unsigned int i = 0; i < getCardinality(final_states_right); i++)
+    for (set_iterator i = SetIterator(final_states_right); hasNextElement(&i);)
     {
-        word state = drawFromSet(final_states_right);
+        word state = nextElement(&i);
         state = Word(2, state, letter_r);
-        delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
+        addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
     }
 
-    function delta = relationToNFADeltaFunction(delta_relation);
+    function delta = relationToNFADeltaFunction(buildSet(delta_relation));
 
-    return NondeterministicFiniteAutomaton(states, alphabet, delta, start, addToSet(Set(), final_state));
+    return NondeterministicFiniteAutomaton(buildSet(states), buildSet(alphabet), delta, start, addToSet(Set(), final_state));
 }
 
 nondeterministic_finite_automaton iterationNFA(nondeterministic_finite_automaton nfa_iter)
@@ -391,25 +541,21 @@ nondeterministic_finite_automaton iterationNFA(nondeterministic_finite_automaton
     word start_iter = getObjectByIndex(nfa_iter, 3);
     set final_states_iter = getObjectByIndex(nfa_iter, 4);
 
-    set states = Set();
-    for (unsigned int i = 0; i < getCardinality(states_iter); i++)
+    set_builder states = SetBuilder();
+    for (set_iterator i = SetIterator(states_iter); hasNextElement(&i);)
     {
-        word state = drawFromSet(states_iter);
+        word state = nextElement(&i);
         state = Word(2, state, letter_i);
-        states = addToSet(states, state);
+        addToSetBuilder(states, state);
     }
 
-    set alphabet = Set();
-    for (unsigned int i = 0; i < getCardinality(alphabet_iter); i++)
-    {
-        letter let = drawFromSet(alphabet_iter);
-        alphabet = addToSet(alphabet, let);
-    }
+    set_builder alphabet = SetBuilder();
+    addSetToSetBuilder(alphabet, alphabet_iter);
 
-    relation delta_relation = Relation();
-    for (unsigned int i = 0; i < getCardinality(delta_iter); i++)
+    set_builder delta_relation = SetBuilder();
+    for (set_iterator i = SetIterator(delta_iter); hasNextElement(&i);)
     {
-        n_tuple tuple = drawFromSet(delta_iter);
+        n_tuple tuple = nextElement(&i);
         set from = getObjectByIndex(tuple, 0);
         set to = getObjectByIndex(tuple, 1);
 
@@ -417,58 +563,59 @@ nondeterministic_finite_automaton iterationNFA(nondeterministic_finite_automaton
         state = Word(2, state, letter_i);
         letter let = getLetterFromNFADeltaFunctionDomainElement(from);
 
-        for (unsigned int j = 0; j < getCardinality(to); j++)
+        for (set_iterator j = SetIterator(to); hasNextElement(&j);)
         {
-            word next_state = drawFromSet(to);
+            word next_state = nextElement(&j);
             next_state = Word(2, next_state, letter_i);
 
-            delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
+            addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), let), addToSet(Set(), next_state));
         }
     }
 
     word start = Word(2, letter_q, letter_0);
     word final_state = Word(2, letter_q, letter_1);
-    states = addToSet(states, start);
-    states = addToSet(states, final_state);
+    addToSetBuilder(states, start);
+    addToSetBuilder(states, final_state);
 
-    delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_iter, letter_i)));
-    delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), final_state));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), Word(2, start_iter, letter_i)));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), start), letter_epsilon), addToSet(Set(), final_state));
 
-    for (unsigned int i = 0; i < getCardinality(final_states_iter); i++)
+    for (set_iterator i = SetIterator(final_states_iter); hasNextElement(&i);)
     {
-        word state = drawFromSet(final_states_iter);
+        word state = nextElement(&i);
         state = Word(2, state, letter_i);
-        delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), Word(2, start_iter, letter_i)));
-        delta_relation = addToRelation(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
+        addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), Word(2, start_iter, letter_i)));
+        addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), state), letter_epsilon), addToSet(Set(), final_state));
     }
 
-    function delta = relationToNFADeltaFunction(delta_relation);
+    function delta = relationToNFADeltaFunction(buildSet(delta_relation));
 
-    return NondeterministicFiniteAutomaton(states, alphabet, delta, start, addToSet(Set(), final_state));
+    return NondeterministicFiniteAutomaton(buildSet(states), buildSet(alphabet), delta, start, addToSet(Set(), final_state));
 }
 
-nondeterministic_finite_automaton regexNFA(word regex)
+/* end receives the index of the bracket closing this subexpression */
+static nondeterministic_finite_automaton regexNFA_(packed_word regex, unsigned int *end)
 {
-    static unsigned int end = 0;
     nondeterministic_finite_automaton nfa1 = NULL;
     nondeterministic_finite_automaton nfa2 = NULL;
     nondeterministic_finite_automaton nfa3 = NULL;
 
-    for (unsigned int i = 0; i < getLength(regex); i++)
+    for (unsigned int i = 0; i < getPackedLength(regex); i++)
     {
-        letter let = getLetterByIndex(regex, i);
+        letter let = getPackedLetterByIndex(regex, i);
 
         if (let == letter_bracket_closed)
         {
-            end = i;
+            *end = i;
             break;
         }
         else if (let == letter_bracket_open)
         {
             nfa2 = concatinationNFA(nfa2, nfa1);
-            word subregex = getSubword(regex, i + 1, getLength(regex));
-            nfa1 = regexNFA(subregex);
-            i += end + 1;
+            packed_word subregex = getPackedSubword(regex, i + 1, getPackedLength(regex));
+            unsigned int subregex_end = 0;
+            nfa1 = regexNFA_(subregex, &subregex_end);
+            i += subregex_end + 1;
         }
         else if (let == letter_star)
         {
@@ -492,3 +639,16 @@ nondeterministic_finite_automaton regexNFA(word regex)
     nfa3 = unionNFA(nfa3, nfa2);
     return nfa3;
 }
+
+nondeterministic_finite_automaton regexNFA(word regex)
+{
+    unsigned int end = 0;
+    return regexNFA_(PackedWord(regex), &end);
+}
+
+/* ε-free, without states that are unreachable or can never accept, and with states of equal
+   future merged */
+nondeterministic_finite_automaton optimizeNFA(nondeterministic_finite_automaton nfa)
+{
+    return optimizeCompiledNFA(compileNFA(nfa));
+}
@@ -1,22 +1,53 @@
 #ifndef NONDETERMINISTIC_FINITE_AUTOMATON_H
 #define NONDETERMINISTIC_FINITE_AUTOMATON_H
 
+#include "compiled_nfa.h"
 #include "nfa_delta_function.h"
 #include "letter.h"
 #include "n_tuple.h"
 #include "set.h"
 #include "word.h"
+#include <stdio.h>
 
 typedef n_tuple nondeterministic_finite_automaton;
 
+/* an nfa run that is fed its input piece by piece; pending holds the start of a utf-8
+   sequence cut off at the end of the previous piece, finishing the matcher releases the run */
+typedef struct nfa_matcher_
+{
+    compiled_nfa_run run;
+    unsigned char pending[4];
+    unsigned int pending_length;
+} nfa_matcher;
+
+/* the outcome of a run over input that is read in, which may fail midway */
+typedef enum nfa_result_
+{
+    NFA_REJECTED,
+    NFA_ACCEPTED,
+    NFA_READ_ERROR
+} nfa_result;
+
 nondeterministic_finite_automaton NondeterministicFiniteAutomaton(set states, set alphabet, nfa_delta_function delta, word start, set final_states);
 void printNFA(nondeterministic_finite_automaton);
+void printNFAToBuffer(print_buffer *b, nondeterministic_finite_automaton nfa);
 bool runNFA(nondeterministic_finite_automaton, void *);
 
+nfa_matcher NFAMatcher(nondeterministic_finite_automaton nfa);
+void feedNFAMatcher(nfa_matcher *m, const char *bytes, size_t length);
+void feedNFAMatcherBytes(nfa_matcher *m, const unsigned char *bytes, size_t length);
+void feedNFAMatcherWide(nfa_matcher *m, const wchar_t *str, size_t length);
+bool finishNFAMatcher(nfa_matcher *m);
+bool runNFAOnBuffer(nondeterministic_finite_automaton nfa, const char *bytes, size_t length);
+nfa_result runNFAOnFile(nondeterministic_finite_automaton nfa, FILE *file);
+nfa_result runNFAOnDescriptor(nondeterministic_finite_automaton nfa, int fd);
+nfa_result runNFAOnMappedFile(nondeterministic_finite_automaton nfa, int fd);
+
 nondeterministic_finite_automaton letterNFA(letter);
 nondeterministic_finite_automaton concatinationNFA(nondeterministic_finite_automaton, nondeterministic_finite_automaton);
 nondeterministic_finite_automaton unionNFA(nondeterministic_finite_automaton, nondeterministic_finite_automaton);
 nondeterministic_finite_automaton iterationNFA(nondeterministic_finite_automaton);
 nondeterministic_finite_automaton regexNFA(word);
+nondeterministic_finite_automaton optimizeNFA(nondeterministic_finite_automaton);
 
 #endif
\ No newline at end of file
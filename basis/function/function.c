@@ -1,26 +1,28 @@
 #include "function.h"
 #include "n_tuple.h"
+#include <stddef.h>
 
 function Function()
 {
     return Relation();
 }
 
+/* the duplicate check freezes f, and addToRelation hands the index on to the result, so a
+   function built up pair by pair is checked in expected O(1) per pair */
 function addToFunction(function f, void *from, void *to)
 {
-    for (unsigned int i = 0; i < getCardinality(f); i++)
-    {
-        void *from_i = getObjectByIndex(drawFromSet(f), 0);
-        if (from_i == from)
-        {
-            return f;
-        }
-    }
+    set_iterator image = getRelationImage(f, from);
+    if (hasNextElement(&image))
+        return f;
 
     return addToRelation(f, from, to);
 }
 
 void *getFunctionValue(function f, void *from)
 {
-    return drawFromSet(getRelationValue(f, from));
+    set_iterator image = getRelationImage(f, from);
+    if (!hasNextElement(&image))
+        return NULL;
+
+    return nextElement(&image);
 }
@@ -34,7 +34,9 @@ function Function(void);
  * @fn function addToFunction(function f, void *from, void *to)
  * @brief Adds a new pair to the function.
  *
- * Inserts a new pair (from, to) into the given function.
+ * Inserts a new pair (from, to) into the given function, unless 'from' already has a value.
+ * f is frozen into a relation index for the check, and the index is carried over to the
+ * result, so each insertion checks for the key in expected O(1).
  *
  * @param f A pointer to the function.
  * @param from The 'from' element in the pair.
@@ -49,6 +51,8 @@ function addToFunction(function f, void *from, void *to);
  *
  * Returns the value associated with the specified 'from' element.
  * This function assumes that each 'from' element in the function is mapped to exactly one 'to' element.
+ * The first lookup freezes f into a relation index, which makes every lookup after it
+ * expected O(1) and free of allocations.
  *
  * @param f A pointer to the function.
  * @param from The 'from' element for which to find the corresponding 'to' element.
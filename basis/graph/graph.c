@@ -0,0 +1,132 @@
+#include "graph.h"
+#include <assert.h>
+#include <stdlib.h>
+
+/* iterative tarjan; components are numbered in reverse topological order, so every component
+   a component reaches has a smaller number than itself */
+static unsigned int stronglyConnectedComponents(graph g, unsigned int *component)
+{
+    unsigned int n = g.vertices;
+    unsigned int *number = malloc((n + 1) * sizeof(unsigned int));
+    unsigned int *low = malloc((n + 1) * sizeof(unsigned int));
+    unsigned int *stack = malloc((n + 1) * sizeof(unsigned int));
+    unsigned int *calls = malloc((n + 1) * sizeof(unsigned int));
+    unsigned int *next_edge = malloc((n + 1) * sizeof(unsigned int));
+    assert(number != NULL && low != NULL && stack != NULL && calls != NULL && next_edge != NULL);
+
+    for (unsigned int v = 0; v < n; v++)
+    {
+        number[v] = NO_VERTEX;
+        component[v] = NO_VERTEX;
+    }
+
+    unsigned int counter = 0;
+    unsigned int components = 0;
+    unsigned int top = 0;
+    for (unsigned int root = 0; root < n; root++)
+    {
+        if (number[root] != NO_VERTEX)
+            continue;
+
+        unsigned int depth = 0;
+        calls[depth++] = root;
+        number[root] = low[root] = counter++;
+        next_edge[root] = g.edge_start[root];
+        stack[top++] = root;
+
+        while (depth > 0)
+        {
+            unsigned int v = calls[depth - 1];
+            if (next_edge[v] < g.edge_start[v + 1])
+            {
+                unsigned int w = g.edges[next_edge[v]++];
+                if (number[w] == NO_VERTEX)
+                {
+                    number[w] = low[w] = counter++;
+                    next_edge[w] = g.edge_start[w];
+                    stack[top++] = w;
+                    calls[depth++] = w;
+                }
+                else if (component[w] == NO_VERTEX && number[w] < low[v])
+                {
+                    low[v] = number[w];
+                }
+                continue;
+            }
+
+            depth--;
+            if (depth > 0 && low[v] < low[calls[depth - 1]])
+                low[calls[depth - 1]] = low[v];
+
+            if (low[v] == number[v])
+            {
+                unsigned int w;
+                do
+                {
+                    w = stack[--top];
+                    component[w] = components;
+                } while (w != v);
+                components++;
+            }
+        }
+    }
+
+    free(number);
+    free(low);
+    free(stack);
+    free(calls);
+    free(next_edge);
+    return components;
+}
+
+graph_components GraphComponents(graph g)
+{
+    unsigned int n = g.vertices;
+    graph_components c;
+    c.component_of = malloc((n + 1) * sizeof(unsigned int));
+    assert(c.component_of != NULL);
+    c.count = stronglyConnectedComponents(g, c.component_of);
+
+    c.member_start = calloc(c.count + 2, sizeof(unsigned int));
+    c.members = malloc((n + 1) * sizeof(unsigned int));
+    assert(c.member_start != NULL && c.members != NULL);
+
+    /* counted one ahead, so the prefix sums leave member_start[k + 1] as the fill cursor of k */
+    for (unsigned int v = 0; v < n; v++)
+        c.member_start[c.component_of[v] + 2]++;
+    for (unsigned int k = 0; k < c.count; k++)
+        c.member_start[k + 2] += c.member_start[k + 1];
+    for (unsigned int v = 0; v < n; v++)
+        c.members[c.member_start[c.component_of[v] + 1]++] = v;
+
+    return c;
+}
+
+void freeGraphComponents(graph_components *c)
+{
+    free(c->component_of);
+    free(c->member_start);
+    free(c->members);
+}
+
+/* breadth first from queue[0] up to queue[tail], which are marked in reached already; every
+   vertex reached from them is marked and queued behind them, and the new tail is returned */
+unsigned int reachVertices(graph g, uint64_t *reached, unsigned int *queue, unsigned int tail)
+{
+    for (unsigned int head = 0; head < tail; head++)
+    {
+        unsigned int v = queue[head];
+        for (unsigned int e = g.edge_start[v]; e < g.edge_start[v + 1]; e++)
+        {
+            unsigned int w = g.edges[e];
+            uint64_t bit = (uint64_t)1 << (w % 64);
+            if ((reached[w / 64] & bit) == 0)
+            {
+                reached[w / 64] |= bit;
+                queue[tail++] = w;
+            }
+        }
+    }
+
+    return tail;
+}
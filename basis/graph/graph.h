@@ -0,0 +1,31 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdint.h>
+
+#define NO_VERTEX ((unsigned int)-1)
+
+/* a directed graph over the vertices 0..vertices - 1, the targets of v are
+   edges[edge_start[v]] up to the start of the next vertex */
+typedef struct graph_
+{
+    unsigned int vertices;
+    const unsigned int *edge_start;
+    const unsigned int *edges;
+} graph;
+
+/* v belongs to component_of[v], the members of component k are
+   members[member_start[k]] up to the start of the next component */
+typedef struct graph_components_
+{
+    unsigned int count;
+    unsigned int *component_of;
+    unsigned int *member_start;
+    unsigned int *members;
+} graph_components;
+
+graph_components GraphComponents(graph g);
+void freeGraphComponents(graph_components *c);
+unsigned int reachVertices(graph g, uint64_t *reached, unsigned int *queue, unsigned int tail);
+
+#endif // GRAPH_H
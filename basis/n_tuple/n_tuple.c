@@ -7,16 +7,11 @@ n_tuple NTupleFromVoidPointerArray(void **contents)
 {
     unsigned int n = *((unsigned int *)contents[0]);
     assert(n >= 2);
-    contents = contents + 1;
 
-    n_tuple t = OrderedPair(contents[0], contents[1]);
+    if (n == 2)
+        return OrderedPair(contents[1], contents[2]);
 
-    for (unsigned int i = 2; i < n; i++)
-    {
-        t = OrderedPair(t, contents[i]);
-    }
-
-    return t;
+    return Sequence(OBJECT_N_TUPLE, contents + 1, n);
 }
 
 n_tuple NTuple(unsigned int n, ...)
@@ -39,32 +34,16 @@ n_tuple NTuple(unsigned int n, ...)
 
 void *getObjectByIndex(n_tuple t, unsigned int idx)
 {
-    unsigned int length = getLength(t);
-    assert(idx < length);
-
-    if (idx == 0 && length == 2)
-    {
-        return getFirst(t);
-    }
-    else if (idx == length - 1)
-    {
-        return getSecond(t);
-    }
-    else
-    {
-        return getObjectByIndex(getFirst(t), idx);
-    }
+    assert(idx < getSequenceLength(t));
+    return getSequenceElements(t)[idx];
 }
 
 unsigned int getLength(n_tuple t)
 {
-    void *first = getFirst(t);
-    if (isObjectAnOrderedPair(first))
-    {
-        return 1 + getLength(first);
-    }
-    else
-    {
-        return 2;
-    }
+    return getSequenceLength(t);
+}
+
+bool isObjectANTuple(void *p)
+{
+    return isObjectASequence(p);
 }
@@ -3,11 +3,12 @@
 
 #include "ordered_pair.h"
 
-typedef ordered_pair n_tuple;
+typedef set n_tuple;
 
 n_tuple NTuple(unsigned int n, ...);
 n_tuple NTupleFromVoidPointerArray(void **contents);
 void *getObjectByIndex(n_tuple t, unsigned int idx);
 unsigned int getLength(n_tuple t);
+bool isObjectANTuple(void *p);
 
 #endif // NTUPLE_H
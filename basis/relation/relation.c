@@ -1,28 +1,650 @@
 #include "relation.h"
 #include "n_tuple.h"
+#include "graph.h"
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_NODE_TABLE_SIZE 16
+#define NO_NODE ((unsigned int)-1)
+
+struct relation_edge
+{
+    void *from;
+    void *to;
+};
+
+/* compressed sparse rows: keys are sorted, the targets of keys[i] are targets[row_start[i]]
+   up to targets[row_start[i + 1]], and slots hashes a key to its row plus one */
+struct relation_rows
+{
+    unsigned int rows;
+    unsigned int size;
+    void **keys;
+    unsigned int *row_start;
+    void **targets;
+    unsigned int *slots;
+};
+
+/* both directions of a frozen relation, carved out of a single allocation */
+struct relation_index
+{
+    struct relation_rows image;
+    struct relation_rows preimage;
+};
+
+/* numbers objects densely in the order they are first seen, so order doubles as a queue */
+struct node_table
+{
+    unsigned int *slots;
+    void **order;
+    unsigned int size;
+    unsigned int cardinality;
+};
+
+static int compareEdges(const void *a, const void *b)
+{
+    const struct relation_edge *x = a;
+    const struct relation_edge *y = b;
+    if (x->from != y->from)
+        return ((uintptr_t)x->from < (uintptr_t)y->from) ? -1 : 1;
+    if (x->to != y->to)
+        return ((uintptr_t)x->to < (uintptr_t)y->to) ? -1 : 1;
+    return 0;
+}
+
+static unsigned int countRows(const struct relation_edge *edges, unsigned int n)
+{
+    unsigned int rows = 0;
+    for (unsigned int k = 0; k < n; k++)
+    {
+        if (k == 0 || edges[k].from != edges[k - 1].from)
+            rows++;
+    }
+
+    return rows;
+}
+
+static unsigned int sizeForRows(unsigned int rows)
+{
+    unsigned int size = 1;
+    while (size < 2 * rows + 1)
+        size *= 2;
+    return size;
+}
+
+static unsigned int slotOf(const struct relation_rows *r, const void *key)
+{
+    uint64_t x = (uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ULL;
+    return (unsigned int)(x >> 32) & (r->size - 1);
+}
+
+static unsigned int slotOfNode(const struct node_table *t, const void *key)
+{
+    uint64_t x = (uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ULL;
+    return (unsigned int)(x >> 32) & (t->size - 1);
+}
+
+static struct node_table NodeTable(void)
+{
+    struct node_table t;
+    t.size = DEFAULT_NODE_TABLE_SIZE;
+    t.cardinality = 0;
+    t.slots = malloc(t.size * sizeof(unsigned int));
+    t.order = malloc(t.size / 2 * sizeof(void *));
+    assert(t.slots != NULL && t.order != NULL);
+    memset(t.slots, 0xff, t.size * sizeof(unsigned int));
+    return t;
+}
+
+static void freeNodeTable(struct node_table *t)
+{
+    free(t->slots);
+    free(t->order);
+}
+
+static unsigned int findNode(const struct node_table *t, const void *key)
+{
+    unsigned int mask = t->size - 1;
+    for (unsigned int i = slotOfNode(t, key); t->slots[i] != NO_NODE; i = (i + 1) & mask)
+    {
+        if (t->order[t->slots[i]] == key)
+            return t->slots[i];
+    }
+
+    return NO_NODE;
+}
+
+/* empties t by resetting only the slots its nodes occupy; cleared slots are walked past rather
+   than ending the search, so every node is still found */
+static void clearNodeTable(struct node_table *t)
+{
+    unsigned int mask = t->size - 1;
+    for (unsigned int k = 0; k < t->cardinality; k++)
+    {
+        unsigned int i = slotOfNode(t, t->order[k]);
+        while (t->slots[i] != k)
+            i = (i + 1) & mask;
+        t->slots[i] = NO_NODE;
+    }
+    t->cardinality = 0;
+}
+
+/* the number of key, which is handed out next if key is new */
+static unsigned int nodeOf(struct node_table *t, void *key)
+{
+    unsigned int id = findNode(t, key);
+    if (id != NO_NODE)
+        return id;
+
+    if (2 * (t->cardinality + 1) > t->size)
+    {
+        t->size *= 2;
+        t->slots = realloc(t->slots, t->size * sizeof(unsigned int));
+        t->order = realloc(t->order, t->size / 2 * sizeof(void *));
+        assert(t->slots != NULL && t->order != NULL);
+        memset(t->slots, 0xff, t->size * sizeof(unsigned int));
+        for (unsigned int k = 0; k < t->cardinality; k++)
+        {
+            unsigned int i = slotOfNode(t, t->order[k]);
+            while (t->slots[i] != NO_NODE)
+                i = (i + 1) & (t->size - 1);
+            t->slots[i] = k;
+        }
+    }
+
+    unsigned int i = slotOfNode(t, key);
+    while (t->slots[i] != NO_NODE)
+        i = (i + 1) & (t->size - 1);
+    t->slots[i] = t->cardinality;
+    t->order[t->cardinality] = key;
+    return t->cardinality++;
+}
+
+static void *carve(char **cursor, size_t bytes)
+{
+    void *p = *cursor;
+    *cursor += bytes;
+    return p;
+}
+
+/* edges are sorted by from, then to */
+static void fillRows(struct relation_rows *r, const struct relation_edge *edges, unsigned int n)
+{
+    unsigned int row = 0;
+    for (unsigned int k = 0; k < n; k++)
+    {
+        if (k == 0 || edges[k].from != edges[k - 1].from)
+        {
+            r->keys[row] = edges[k].from;
+            r->row_start[row] = k;
+            row++;
+        }
+        r->targets[k] = edges[k].to;
+    }
+    r->row_start[r->rows] = n;
+
+    unsigned int mask = r->size - 1;
+    for (row = 0; row < r->rows; row++)
+    {
+        unsigned int i = slotOf(r, r->keys[row]);
+        while (r->slots[i] != 0)
+            i = (i + 1) & mask;
+        r->slots[i] = row + 1;
+    }
+}
+
+static set_iterator rowOf(const struct relation_rows *r, const void *key)
+{
+    set_iterator it;
+    it.elements = NULL;
+    it.cardinality = 0;
+    it.index = 0;
+
+    unsigned int mask = r->size - 1;
+    for (unsigned int i = slotOf(r, key); r->slots[i] != 0; i = (i + 1) & mask)
+    {
+        unsigned int row = r->slots[i] - 1;
+        if (r->keys[row] == key)
+        {
+            it.elements = r->targets + r->row_start[row];
+            it.cardinality = r->row_start[row + 1] - r->row_start[row];
+            break;
+        }
+    }
+
+    return it;
+}
+
+/* both edge lists are sorted by from, then to */
+static struct relation_index *RelationIndex(const struct relation_edge *forward, const struct relation_edge *backward, unsigned int n)
+{
+    unsigned int image_rows = countRows(forward, n);
+    unsigned int preimage_rows = countRows(backward, n);
+    unsigned int image_size = sizeForRows(image_rows);
+    unsigned int preimage_size = sizeForRows(preimage_rows);
+
+    /* pointer arrays first, so every array stays aligned */
+    size_t pointers = image_rows + preimage_rows + 2 * (size_t)n;
+    size_t integers = image_rows + 1 + preimage_rows + 1 + (size_t)image_size + preimage_size;
+    struct relation_index *index = calloc(1, sizeof(struct relation_index) + pointers * sizeof(void *) + integers * sizeof(unsigned int));
+    assert(index != NULL);
+
+    char *cursor = (char *)(index + 1);
+    index->image.rows = image_rows;
+    index->image.size = image_size;
+    index->preimage.rows = preimage_rows;
+    index->preimage.size = preimage_size;
+    index->image.keys = carve(&cursor, image_rows * sizeof(void *));
+    index->image.targets = carve(&cursor, n * sizeof(void *));
+    index->preimage.keys = carve(&cursor, preimage_rows * sizeof(void *));
+    index->preimage.targets = carve(&cursor, n * sizeof(void *));
+    index->image.row_start = carve(&cursor, (image_rows + 1) * sizeof(unsigned int));
+    index->image.slots = carve(&cursor, image_size * sizeof(unsigned int));
+    index->preimage.row_start = carve(&cursor, (preimage_rows + 1) * sizeof(unsigned int));
+    index->preimage.slots = carve(&cursor, preimage_size * sizeof(unsigned int));
+
+    fillRows(&index->image, forward, n);
+    fillRows(&index->preimage, backward, n);
+    return index;
+}
+
+static struct relation_index *getRelationIndex(relation r)
+{
+    struct relation_index *index = getSetIndex(r);
+    if (index != NULL)
+        return index;
+
+    unsigned int n = getCardinality(r);
+    struct relation_edge *forward = malloc((n + 1) * sizeof(struct relation_edge));
+    struct relation_edge *backward = malloc((n + 1) * sizeof(struct relation_edge));
+    assert(forward != NULL && backward != NULL);
+
+    unsigned int k = 0;
+    for (set_iterator i = SetIterator(r); hasNextElement(&i); k++)
+    {
+        n_tuple t = nextElement(&i);
+        forward[k].from = backward[k].to = getObjectByIndex(t, 0);
+        forward[k].to = backward[k].from = getObjectByIndex(t, 1);
+    }
+    qsort(forward, n, sizeof(struct relation_edge), compareEdges);
+    qsort(backward, n, sizeof(struct relation_edge), compareEdges);
+
+    index = RelationIndex(forward, backward, n);
+    free(forward);
+    free(backward);
+
+    return attachSetIndex(r, index);
+}
+
+/* the edges of r in their sorted order, with edge merged in at its place */
+static void spliceEdge(const struct relation_rows *r, struct relation_edge edge, struct relation_edge *edges)
+{
+    unsigned int k = 0;
+    bool placed = false;
+    for (unsigned int row = 0; row < r->rows; row++)
+    {
+        for (unsigned int e = r->row_start[row]; e < r->row_start[row + 1]; e++)
+        {
+            struct relation_edge current;
+            current.from = r->keys[row];
+            current.to = r->targets[e];
+            if (!placed && compareEdges(&edge, &current) < 0)
+            {
+                edges[k++] = edge;
+                placed = true;
+            }
+            edges[k++] = current;
+        }
+    }
+
+    if (!placed)
+        edges[k] = edge;
+}
 
 relation Relation()
 {
     return Set();
 }
 
+/* a frozen relation hands its index on to the extended one, spliced in linear time instead of
+   sorted again, so a chain of insertions stays frozen all along */
 relation addToRelation(relation r, void *from, void *to)
 {
-    return addToSet(r, NTuple(2, from, to));
+    relation extended = addToSet(r, NTuple(2, from, to));
+    struct relation_index *index = getSetIndex(r);
+    if (index == NULL || extended == r || getSetIndex(extended) != NULL)
+        return extended;
+
+    unsigned int n = index->image.row_start[index->image.rows];
+    struct relation_edge *forward = malloc((n + 2) * sizeof(struct relation_edge));
+    struct relation_edge *backward = malloc((n + 2) * sizeof(struct relation_edge));
+    assert(forward != NULL && backward != NULL);
+
+    struct relation_edge edge;
+    edge.from = from;
+    edge.to = to;
+    spliceEdge(&index->image, edge, forward);
+    edge.from = to;
+    edge.to = from;
+    spliceEdge(&index->preimage, edge, backward);
+
+    (void)attachSetIndex(extended, RelationIndex(forward, backward, n + 1));
+    free(forward);
+    free(backward);
+
+    return extended;
+}
+
+void addToRelationBuilder(set_builder b, void *from, void *to)
+{
+    addToSetBuilder(b, NTuple(2, from, to));
+}
+
+void freezeRelation(relation r)
+{
+    (void)getRelationIndex(r);
+}
+
+bool isRelationFrozen(relation r)
+{
+    return getSetIndex(r) != NULL;
+}
+
+set_iterator getRelationImage(relation r, void *from)
+{
+    return rowOf(&getRelationIndex(r)->image, from);
+}
+
+set_iterator getRelationPreimage(relation r, void *to)
+{
+    return rowOf(&getRelationIndex(r)->preimage, to);
+}
+
+set getRelationImageOfSet(relation r, set s)
+{
+    struct relation_index *index = getRelationIndex(r);
+
+    set_builder b = SetBuilder();
+    for (set_iterator i = SetIterator(s); hasNextElement(&i);)
+    {
+        for (set_iterator j = rowOf(&index->image, nextElement(&i)); hasNextElement(&j);)
+        {
+            addToSetBuilder(b, nextElement(&j));
+        }
+    }
+
+    return buildSet(b);
 }
 
 set getRelationValue(relation r, void *from)
 {
-    set result = Set();
-    for (unsigned int i = 0; i < getCardinality(r); i++)
+    set_builder b = SetBuilder();
+    for (set_iterator i = getRelationImage(r, from); hasNextElement(&i);)
+    {
+        addToSetBuilder(b, nextElement(&i));
+    }
+
+    return buildSet(b);
+}
+
+/* r followed by s: a is related to c if a r b and b s c for some b; each a costs the
+   fan-out of s summed over its targets, so dense relations compose in quadratic time */
+relation compositionRelation(relation r, relation s)
+{
+    struct relation_index *first = getRelationIndex(r);
+    struct relation_index *second = getRelationIndex(s);
+
+    set_builder b = SetBuilder();
+    struct node_table targets = NodeTable();
+    for (unsigned int row = 0; row < first->image.rows; row++)
+    {
+        /* targets collects the distinct c of one a, so every pair is built only once */
+        clearNodeTable(&targets);
+        for (unsigned int k = first->image.row_start[row]; k < first->image.row_start[row + 1]; k++)
+        {
+            for (set_iterator i = rowOf(&second->image, first->image.targets[k]); hasNextElement(&i);)
+            {
+                (void)nodeOf(&targets, nextElement(&i));
+            }
+        }
+
+        for (unsigned int k = 0; k < targets.cardinality; k++)
+        {
+            addToRelationBuilder(b, first->image.keys[row], targets.order[k]);
+        }
+    }
+    freeNodeTable(&targets);
+
+    return buildSet(b);
+}
+
+relation inverseRelation(relation r)
+{
+    struct relation_rows *preimage = &getRelationIndex(r)->preimage;
+
+    set_builder b = SetBuilder();
+    for (unsigned int row = 0; row < preimage->rows; row++)
+    {
+        for (unsigned int k = preimage->row_start[row]; k < preimage->row_start[row + 1]; k++)
+        {
+            addToRelationBuilder(b, preimage->keys[row], preimage->targets[k]);
+        }
+    }
+
+    return buildSet(b);
+}
+
+/* the pairs of r whose first element is in s */
+relation restrictionRelation(relation r, set s)
+{
+    struct relation_index *index = getRelationIndex(r);
+
+    set_builder b = SetBuilder();
+    for (set_iterator i = SetIterator(s); hasNextElement(&i);)
+    {
+        void *from = nextElement(&i);
+        for (set_iterator j = rowOf(&index->image, from); hasNextElement(&j);)
+        {
+            addToRelationBuilder(b, from, nextElement(&j));
+        }
+    }
+
+    return buildSet(b);
+}
+
+/* s together with everything r reaches from it, breadth first */
+set getReachableSet(relation r, set s)
+{
+    struct relation_index *index = getRelationIndex(r);
+
+    struct node_table reached = NodeTable();
+    for (set_iterator i = SetIterator(s); hasNextElement(&i);)
+    {
+        (void)nodeOf(&reached, nextElement(&i));
+    }
+    for (unsigned int k = 0; k < reached.cardinality; k++)
+    {
+        for (set_iterator i = rowOf(&index->image, reached.order[k]); hasNextElement(&i);)
+        {
+            (void)nodeOf(&reached, nextElement(&i));
+        }
+    }
+
+    set_builder b = SetBuilder();
+    for (unsigned int k = 0; k < reached.cardinality; k++)
+    {
+        addToSetBuilder(b, reached.order[k]);
+    }
+    freeNodeTable(&reached);
+
+    return buildSet(b);
+}
+
+/* the field of r as a graph over dense node numbers, adjacency in compressed sparse rows */
+struct relation_graph
+{
+    struct node_table nodes;
+    unsigned int *edge_start;
+    unsigned int *edges;
+};
+
+static struct relation_graph RelationGraph(relation r)
+{
+    struct relation_rows *image = &getRelationIndex(r)->image;
+
+    struct relation_graph g;
+    g.nodes = NodeTable();
+    for (unsigned int row = 0; row < image->rows; row++)
+    {
+        (void)nodeOf(&g.nodes, image->keys[row]);
+        for (unsigned int k = image->row_start[row]; k < image->row_start[row + 1]; k++)
+        {
+            (void)nodeOf(&g.nodes, image->targets[k]);
+        }
+    }
+
+    unsigned int n = g.nodes.cardinality;
+    g.edge_start = calloc(n + 1, sizeof(unsigned int));
+    g.edges = malloc((image->row_start[image->rows] + 1) * sizeof(unsigned int));
+    assert(g.edge_start != NULL && g.edges != NULL);
+
+    for (unsigned int row = 0; row < image->rows; row++)
+    {
+        g.edge_start[findNode(&g.nodes, image->keys[row]) + 1] = image->row_start[row + 1] - image->row_start[row];
+    }
+    for (unsigned int v = 0; v < n; v++)
+    {
+        g.edge_start[v + 1] += g.edge_start[v];
+    }
+    for (unsigned int row = 0; row < image->rows; row++)
+    {
+        unsigned int e = g.edge_start[findNode(&g.nodes, image->keys[row])];
+        for (unsigned int k = image->row_start[row]; k < image->row_start[row + 1]; k++)
+        {
+            g.edges[e++] = findNode(&g.nodes, image->targets[k]);
+        }
+    }
+
+    return g;
+}
+
+static void freeRelationGraph(struct relation_graph *g)
+{
+    freeNodeTable(&g->nodes);
+    free(g->edge_start);
+    free(g->edges);
+}
+
+static unsigned int appendReach(unsigned int **reach, unsigned int *size, unsigned int length, unsigned int c)
+{
+    if (length == *size)
+    {
+        *size *= 2;
+        *reach = realloc(*reach, *size * sizeof(unsigned int));
+        assert(*reach != NULL);
+    }
+
+    (*reach)[length] = c;
+    return length + 1;
+}
+
+/* reachability is propagated over the condensation as one list of components per component,
+   in reverse topological order so every list a component needs is complete; a component
+   already collected brings nothing new, since everything it reaches came with it, and the
+   lists together take no more room than the closure they describe */
+static relation closureRelation(relation r, bool reflexive)
+{
+    struct relation_graph g = RelationGraph(r);
+    unsigned int n = g.nodes.cardinality;
+
+    graph view = {n, g.edge_start, g.edges};
+    graph_components components = GraphComponents(view);
+    unsigned int *component = components.component_of;
+    unsigned int *member_start = components.member_start;
+    unsigned int *members = components.members;
+    bool *cyclic = calloc(components.count + 1, sizeof(bool));
+    unsigned int *reach_start = malloc((components.count + 1) * sizeof(unsigned int));
+    unsigned int *seen = calloc(components.count + 1, sizeof(unsigned int));
+    unsigned int size = components.count + 1;
+    unsigned int *reach = malloc(size * sizeof(unsigned int));
+    assert(cyclic != NULL && reach_start != NULL && seen != NULL && reach != NULL);
+
+    unsigned int length = 0;
+    for (unsigned int c = 0; c < components.count; c++)
+    {
+        /* seen holds the component plus one that last collected a component */
+        reach_start[c] = length;
+        seen[c] = c + 1;
+        length = appendReach(&reach, &size, length, c);
+        if (member_start[c + 1] - member_start[c] > 1)
+            cyclic[c] = true;
+
+        for (unsigned int m = member_start[c]; m < member_start[c + 1]; m++)
+        {
+            unsigned int v = members[m];
+            for (unsigned int e = g.edge_start[v]; e < g.edge_start[v + 1]; e++)
+            {
+                unsigned int d = component[g.edges[e]];
+                if (d == c)
+                {
+                    cyclic[c] = true;
+                    continue;
+                }
+                if (seen[d] == c + 1)
+                    continue;
+
+                for (unsigned int k = reach_start[d]; k < reach_start[d + 1]; k++)
+                {
+                    unsigned int o = reach[k];
+                    if (seen[o] == c + 1)
+                        continue;
+
+                    seen[o] = c + 1;
+                    length = appendReach(&reach, &size, length, o);
+                }
+            }
+        }
+        reach_start[c + 1] = length;
+    }
+
+    set_builder b = SetBuilder();
+    for (unsigned int c = 0; c < components.count; c++)
     {
-        n_tuple t = drawFromSet(r);
-        if (getObjectByIndex(t, 0) == from)
+        for (unsigned int k = reach_start[c]; k < reach_start[c + 1]; k++)
         {
-            result = addToSet(result, getObjectByIndex(t, 1));
+            unsigned int d = reach[k];
+            if (d == c && !reflexive && !cyclic[c])
+                continue;
+
+            for (unsigned int m = member_start[c]; m < member_start[c + 1]; m++)
+            {
+                for (unsigned int o = member_start[d]; o < member_start[d + 1]; o++)
+                {
+                    addToRelationBuilder(b, g.nodes.order[members[m]], g.nodes.order[members[o]]);
+                }
+            }
         }
     }
 
-    return result;
-}
\ No newline at end of file
+    free(reach);
+    free(seen);
+    free(reach_start);
+    free(cyclic);
+    freeGraphComponents(&components);
+    freeRelationGraph(&g);
+
+    return buildSet(b);
+}
+
+relation transitiveClosureRelation(relation r)
+{
+    return closureRelation(r, false);
+}
+
+/* reflexive over the field of r, the objects that occur in any of its pairs */
+relation reflexiveTransitiveClosureRelation(relation r)
+{
+    return closureRelation(r, true);
+}
@@ -7,6 +7,19 @@ typedef set relation;
 
 relation Relation(void);
 relation addToRelation(relation r, void *from, void *to);
+void addToRelationBuilder(set_builder b, void *from, void *to);
+void freezeRelation(relation r);
+bool isRelationFrozen(relation r);
+set_iterator getRelationImage(relation r, void *from);
+set_iterator getRelationPreimage(relation r, void *to);
+set getRelationImageOfSet(relation r, set s);
 set getRelationValue(relation r, void *from);
 
+relation compositionRelation(relation r, relation s);
+relation inverseRelation(relation r);
+relation restrictionRelation(relation r, set s);
+relation transitiveClosureRelation(relation r);
+relation reflexiveTransitiveClosureRelation(relation r);
+set getReachableSet(relation r, set s);
+
 #endif // RELATION_H
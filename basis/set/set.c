@@ -1,144 +1,635 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "set.h"
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef SET_STATISTICS
+#include <wchar.h>
+#endif
 
-#define DEFAULT_UNIVERSE_SIZE 100000
+/* the universe is split into independently locked shards, picked by the top hash bits */
+#define UNIVERSE_SHARD_BITS 6
+#define UNIVERSE_SHARDS (1u << UNIVERSE_SHARD_BITS)
+#define DEFAULT_SHARD_SIZE 16
 #define DEFAULT_SET_SIZE 100
+#define DEFAULT_ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+#define MAX_SET_DOMAINS 16
+#define BITS_PER_WORD 64
+#define MAX_SET_BITMAP_WORDS 16
+
+/* a dense domain is a registered array of objects, addressed by their index in it */
+struct set_domain
+{
+    char *base;
+    size_t stride;
+    unsigned int size;
+    object_kind kind;
+};
 
+/* elements are kept in ascending address order in data, which is sized to the cardinality
+   and shares the single arena allocation of its header; hash is the order independent sum
+   of the element hashes, so adding or removing one element updates it in O(1); an interned
+   set whose elements all come from one dense domain also carries a bitmap over its indices,
+   words long, as long as those indices are small enough;
+   a sequence shares the layout, but keeps data in the order it was given and is never a set;
+   the kind tag tells the two apart, and the kinds of sequence from each other; lookup_index
+   is an optional structure derived from data, malloc'd as one block and freed with the set */
 struct set_
+{
+    uint64_t hash;
+    unsigned int cardinality;
+    unsigned int generation;
+    bool marked;
+    unsigned char kind;
+    unsigned short words;
+    const struct set_domain *domain;
+    uint64_t *bits;
+    void *lookup_index;
+    void *data[];
+};
+
+/* a mutable, unsorted staging area; only buildSet turns it into an interned set */
+struct set_builder_
 {
     unsigned int size;
-    unsigned int index;
+    unsigned int cardinality;
     void **data;
 };
 
-set universe_of_discourse[DEFAULT_UNIVERSE_SIZE] = {NULL};
+struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+/* every set lives in the arena of the generation that was current when it was interned */
+struct generation
+{
+    struct arena_block *blocks;
+    unsigned int population;
+};
+
+/* the hash is repeated next to the pointer so probes can skip mismatches without touching the set */
+struct universe_entry
+{
+    uint64_t hash;
+    set s;
+};
+
+/* open addressing with linear probing, always a power of two and at least twice the cardinality */
+struct universe_table
+{
+    struct universe_entry *entries;
+    unsigned int size;
+    unsigned int cardinality;
+};
+
+/* structural index: content hash -> interned set */
+struct universe_shard
+{
+    pthread_mutex_t lock;
+    struct universe_table table;
+};
+
+/* membership index: set pointer -> interned set, backs isObjectASet */
+struct membership_shard
+{
+    pthread_rwlock_t lock;
+    struct universe_table table;
+};
+
+static struct universe_shard universe_of_discourse[UNIVERSE_SHARDS];
+static struct membership_shard universe_members[UNIVERSE_SHARDS];
+static pthread_once_t universe_once = PTHREAD_ONCE_INIT;
+static set empty_set = NULL;
+
+/* generations are only switched and swept while no other thread works on the universe; the
+   epoch is published with release and read with acquire, so a thread that sees a new epoch
+   also sees the generation it belongs to */
+static pthread_mutex_t generations_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct generation *generations = NULL;
+static unsigned int generations_size = 0;
+static unsigned int current_generation = 0;
+static unsigned int generation_epoch = 0;
+
+/* candidates between Set_ and their interning, only counted to assert that no generation is
+   switched or swept under one of them */
+#ifndef NDEBUG
+static unsigned int candidates_in_flight = 0;
+#define BEGIN_CANDIDATE() ((void)__atomic_add_fetch(&candidates_in_flight, 1, __ATOMIC_ACQ_REL))
+#define END_CANDIDATE() ((void)__atomic_sub_fetch(&candidates_in_flight, 1, __ATOMIC_ACQ_REL))
+#else
+#define BEGIN_CANDIDATE() ((void)0)
+#define END_CANDIDATE() ((void)0)
+#endif
 
+/* each thread bump-allocates from a block of its own, so candidates can be handed back */
+static __thread struct arena_block *thread_block = NULL;
+static __thread unsigned int thread_block_epoch = 0;
+static __thread unsigned int thread_generation = 0;
+
+#ifdef SET_STATISTICS
+static set_statistics statistics;
+#define COUNT(counter, n) ((void)__atomic_add_fetch(&statistics.counter, (n), __ATOMIC_RELAXED))
+#else
+#define COUNT(counter, n) ((void)0)
+#endif
+
+/* domains are only ever appended, readers see a prefix published by the cardinality */
+static pthread_mutex_t domains_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct set_domain domains[MAX_SET_DOMAINS];
+static unsigned int domains_cardinality = 0;
+
+static pthread_mutex_t roots_lock = PTHREAD_MUTEX_INITIALIZER;
+static set *roots = NULL;
+static unsigned int roots_size = 0;
+static unsigned int roots_cardinality = 0;
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t hashPointer(const void *p)
+{
+    return mix((uint64_t)(uintptr_t)p);
+}
+
+static unsigned int shardIndex(uint64_t hash)
+{
+    return (unsigned int)(hash >> (64 - UNIVERSE_SHARD_BITS));
+}
+
+static size_t alignToArena(size_t n)
+{
+    return (n + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static void *allocateFromArena(size_t n)
+{
+    n = alignToArena(n);
+
+    unsigned int epoch = __atomic_load_n(&generation_epoch, __ATOMIC_ACQUIRE);
+    if (thread_block == NULL || thread_block_epoch != epoch || thread_block->size - thread_block->used < n)
+    {
+        size_t size = alignToArena(sizeof(struct arena_block)) + n;
+        if (size < DEFAULT_ARENA_BLOCK_SIZE)
+            size = DEFAULT_ARENA_BLOCK_SIZE;
+
+        struct arena_block *b = malloc(size);
+        assert(b != NULL);
+        b->size = size;
+        b->used = alignToArena(sizeof(struct arena_block));
+
+        pthread_mutex_lock(&generations_lock);
+        struct generation *g = &generations[current_generation];
+        b->next = g->blocks;
+        g->blocks = b;
+        thread_block = b;
+        thread_block_epoch = __atomic_load_n(&generation_epoch, __ATOMIC_RELAXED);
+        thread_generation = current_generation;
+        pthread_mutex_unlock(&generations_lock);
+    }
+
+    void *p = (char *)thread_block + thread_block->used;
+    thread_block->used += n;
+    return p;
+}
+
+/* only the most recent allocation of this thread can be shrunk or handed back, which is all
+   an over-allocated or rejected candidate needs */
+static void shrinkInArena(void *p, size_t n, size_t m)
+{
+    struct arena_block *b = thread_block;
+    n = alignToArena(n);
+    m = alignToArena(m);
+
+    if ((char *)p + n == (char *)b + b->used)
+    {
+        b->used -= n - m;
+    }
+}
+
+static void freeGeneration(struct generation *g)
+{
+    while (g->blocks != NULL)
+    {
+        struct arena_block *next = g->blocks->next;
+        free(g->blocks);
+        g->blocks = next;
+    }
+}
+
+static size_t sizeOfSet_(unsigned int size)
+{
+    return sizeof(struct set_) + size * sizeof(void *);
+}
+
+/* room for size elements, the caller fills data and sets the cardinality */
 static set Set_(unsigned int size)
 {
-    set s = malloc(sizeof(struct set_));
-    s->size = size;
-    s->index = 0;
-    s->data = calloc(s->size, sizeof(void *));
+    BEGIN_CANDIDATE();
+    set s = allocateFromArena(sizeOfSet_(size));
+    COUNT(sets_allocated, 1);
+    s->hash = 0;
+    s->cardinality = 0;
+    s->generation = thread_generation;
+    s->marked = false;
+    s->kind = OBJECT_SET;
+    s->domain = NULL;
+    s->words = 0;
+    s->bits = NULL;
+    s->lookup_index = NULL;
     return s;
 }
 
-set Set()
+/* hands back the room a candidate reserved beyond its cardinality */
+static void trimSet_(set s, unsigned int size)
 {
-    if (universe_of_discourse[0] == NULL)
+    shrinkInArena(s, sizeOfSet_(size), sizeOfSet_(s->cardinality));
+}
+
+static void freeSet_(set s)
+{
+    shrinkInArena(s, sizeOfSet_(s->cardinality), 0);
+}
+
+static bool precedes(const void *a, const void *b)
+{
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+/* index of the first element that does not precede object */
+static unsigned int lowerBound(set s, void *object)
+{
+    unsigned int low = 0;
+    unsigned int high = s->cardinality;
+    while (low < high)
     {
-        universe_of_discourse[0] = Set_(DEFAULT_SET_SIZE);
-        return universe_of_discourse[0];
+        unsigned int mid = low + (high - low) / 2;
+        if (precedes(s->data[mid], object))
+            low = mid + 1;
+        else
+            high = mid;
     }
-    else
+
+    return low;
+}
+
+long int find(set s, void *object)
+{
+    COUNT(find_calls, 1);
+    unsigned int i = lowerBound(s, object);
+    if (i < s->cardinality && s->data[i] == object)
     {
-        return universe_of_discourse[0];
+        return i;
     }
+
+    return -1;
 }
 
-bool isObjectASet(void *p)
+/* places object at its sorted position, the caller guarantees room and absence */
+static void insertSorted(set s, void *object)
 {
-    assert(p != NULL);
+    unsigned int i = lowerBound(s, object);
+    memmove(s->data + i + 1, s->data + i, (s->cardinality - i) * sizeof(void *));
+    s->data[i] = object;
+    s->cardinality++;
+}
+
+static uint64_t hashSet(set s)
+{
+    uint64_t hash = 0;
+    for (unsigned int i = 0; i < s->cardinality; i++)
+    {
+        hash += hashPointer(s->data[i]);
+    }
+
+    return hash;
+}
+
+/* unlike hashSet this depends on the position of every element */
+static uint64_t hashSequence(set s)
+{
+    uint64_t hash = s->cardinality;
+    for (unsigned int i = 0; i < s->cardinality; i++)
+    {
+        hash = mix(hash + hashPointer(s->data[i]));
+    }
+
+    return hash;
+}
+
+static bool indexInDomain(const struct set_domain *d, const void *object, unsigned int *index)
+{
+    uintptr_t base = (uintptr_t)d->base;
+    uintptr_t p = (uintptr_t)object;
+    if (p < base || p - base >= d->size * d->stride || (p - base) % d->stride != 0)
+        return false;
+
+    *index = (unsigned int)((p - base) / d->stride);
+    return true;
+}
+
+static const struct set_domain *findDomain(const void *object)
+{
+    unsigned int n = __atomic_load_n(&domains_cardinality, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        unsigned int index;
+        if (indexInDomain(&domains[i], object, &index))
+            return &domains[i];
+    }
+
+    return NULL;
+}
+
+/* bitmaps of different lengths are read as if padded with zeros */
+static uint64_t wordOf(set s, unsigned int w)
+{
+    return (w < s->words) ? s->bits[w] : 0;
+}
+
+/* only called for a set that is about to be interned, so a rejected candidate never owns a bitmap */
+static void attachBits(set s)
+{
+    if (s->kind != OBJECT_SET || s->cardinality == 0)
+        return;
+
+    const struct set_domain *d = findDomain(s->data[0]);
+    if (d == NULL)
+        return;
 
-    for (unsigned int i = 0; i < DEFAULT_UNIVERSE_SIZE; i++)
+    /* elements are sorted by address, so the last one has the largest index */
+    unsigned int last;
+    if (!indexInDomain(d, s->data[s->cardinality - 1], &last) || last / BITS_PER_WORD >= MAX_SET_BITMAP_WORDS)
+        return;
+
+    uint64_t bits[MAX_SET_BITMAP_WORDS] = {0};
+    for (unsigned int i = 0; i < s->cardinality; i++)
     {
-        if (universe_of_discourse[i] == p)
+        unsigned int index;
+        if (!indexInDomain(d, s->data[i], &index))
+            return;
+        bits[index / BITS_PER_WORD] |= (uint64_t)1 << (index % BITS_PER_WORD);
+    }
+
+    s->words = (unsigned short)(last / BITS_PER_WORD + 1);
+    s->bits = allocateFromArena(s->words * sizeof(uint64_t));
+    memcpy(s->bits, bits, s->words * sizeof(uint64_t));
+    s->domain = d;
+}
+
+static bool shareDomain(set s, set t)
+{
+    return s->domain != NULL && s->domain == t->domain;
+}
+
+static bool contains(set s, void *object)
+{
+    if (s->domain != NULL)
+    {
+        unsigned int index;
+        return indexInDomain(s->domain, object, &index) && (wordOf(s, index / BITS_PER_WORD) >> (index % BITS_PER_WORD)) & 1;
+    }
+
+    return find(s, object) != -1;
+}
+
+static void placeInTable(struct universe_table *t, uint64_t hash, set s)
+{
+    unsigned int mask = t->size - 1;
+    unsigned int i = (unsigned int)(hash & mask);
+    while (t->entries[i].s != NULL)
+        i = (i + 1) & mask;
+    t->entries[i].hash = hash;
+    t->entries[i].s = s;
+    t->cardinality++;
+}
+
+/* rehashes t into size slots; sets only move their index entries, never themselves */
+static void resizeTable(struct universe_table *t, unsigned int size, bool only_marked)
+{
+    struct universe_entry *old_entries = t->entries;
+    unsigned int old_size = t->size;
+
+    t->entries = calloc(size, sizeof(struct universe_entry));
+    assert(t->entries != NULL);
+    t->size = size;
+    t->cardinality = 0;
+
+    for (unsigned int i = 0; i < old_size; i++)
+    {
+        set s = old_entries[i].s;
+        if (s != NULL && (!only_marked || s->marked))
         {
-            return true;
+            placeInTable(t, old_entries[i].hash, s);
         }
     }
 
-    return false;
+    free(old_entries);
 }
 
-long int find(set s, void *object)
+static void insertIntoTable(struct universe_table *t, uint64_t hash, set s)
+{
+    if (2 * (t->cardinality + 1) > t->size)
+    {
+        unsigned int size = (t->size == 0) ? DEFAULT_SHARD_SIZE : t->size * 2;
+        assert(size > t->size && "Universe is full.");
+        resizeTable(t, size, false);
+    }
+
+    placeInTable(t, hash, s);
+}
+
+/* the interned set or sequence at p, or NULL if p is not in the universe */
+static set findMember(void *p)
 {
-    for (unsigned int i = 0; i < s->size; i++)
+    uint64_t hash = hashPointer(p);
+    struct universe_table *t = &universe_members[shardIndex(hash)].table;
+    if (t->size == 0)
+        return NULL;
+
+    unsigned int mask = t->size - 1;
+    unsigned int i = (unsigned int)(hash & mask);
+    while (t->entries[i].s != NULL)
     {
-        if (s->data[i] == object)
+        COUNT(membership_probes, 1);
+        if (t->entries[i].s == p)
         {
-            return i;
+            return t->entries[i].s;
         }
+        i = (i + 1) & mask;
     }
 
-    return -1;
+    return NULL;
 }
 
-static void *draw(set s)
+static set checkForIdenticalSetInUniverse(set s);
+static void beginGeneration(void);
+
+static void initializeUniverse(void)
 {
-    unsigned int loops = 0;
-    do
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
     {
-        s->index = (s->index + 1) % s->size;
-        loops++;
-    } while (s->data[s->index] == NULL && loops < s->size);
+        pthread_mutex_init(&universe_of_discourse[i].lock, NULL);
+        pthread_rwlock_init(&universe_members[i].lock, NULL);
+    }
 
-    return s->data[s->index];
+    beginGeneration();
+    empty_set = checkForIdenticalSetInUniverse(Set_(0));
 }
 
+static void ensureUniverse(void)
+{
+    pthread_once(&universe_once, initializeUniverse);
+}
+
+set Set()
+{
+    ensureUniverse();
+    return empty_set;
+}
+
+static set lookupMember(void *p)
+{
+    assert(p != NULL);
+    ensureUniverse();
+    COUNT(membership_checks, 1);
+
+    pthread_rwlock_t *lock = &universe_members[shardIndex(hashPointer(p))].lock;
+    pthread_rwlock_rdlock(lock);
+    set member = findMember(p);
+    pthread_rwlock_unlock(lock);
+
+    return member;
+}
+
+bool isObjectASet(void *p)
+{
+    set member = lookupMember(p);
+    return member != NULL && member->kind == OBJECT_SET;
+}
+
+bool isObjectASequence(void *p)
+{
+    set member = lookupMember(p);
+    return member != NULL && member->kind != OBJECT_SET;
+}
+
+/* sets keep no cursor, so this always draws the same element; walk them with SetIterator */
 void *drawFromSet(set s)
 {
     assert(isObjectASet(s));
-    return draw(s);
+    return (s->cardinality > 0) ? s->data[0] : NULL;
 }
 
-static set checkForIdenticalSetInUniverse(set s)
+set_iterator SetIterator(set s)
 {
-    for (unsigned int i = 0; i < DEFAULT_UNIVERSE_SIZE; i++)
+    assert(isObjectASet(s));
+
+    set_iterator it;
+    it.elements = s->data;
+    it.cardinality = s->cardinality;
+    it.index = 0;
+    return it;
+}
+
+bool hasNextElement(set_iterator *it)
+{
+    return it->index < it->cardinality;
+}
+
+void *nextElement(set_iterator *it)
+{
+    assert(hasNextElement(it));
+    return it->elements[it->index++];
+}
+
+void *const *getElements(set s)
+{
+    assert(isObjectASet(s));
+    return s->data;
+}
+
+static set findIdenticalSet(struct universe_table *t, set s)
+{
+    if (t->size == 0)
+        return NULL;
+
+    unsigned int mask = t->size - 1;
+    unsigned int i = (unsigned int)(s->hash & mask);
+    while (t->entries[i].s != NULL)
     {
-        set u_s = universe_of_discourse[i];
+        set u_s = t->entries[i].s;
+        COUNT(intern_probes, 1);
 
-        if (u_s == NULL)
+        /* both element arrays are in canonical order, so equal sets are equal byte for byte */
+        if (t->entries[i].hash == s->hash && u_s->kind == s->kind && u_s->cardinality == s->cardinality &&
+            memcmp(u_s->data, s->data, s->cardinality * sizeof(void *)) == 0)
         {
-            universe_of_discourse[i] = s;
-            return s;
-        }
-        else if (find(u_s, NULL) == find(s, NULL))
-        {
-            bool identical = true;
-
-            for (unsigned int j = 0; j < s->size; j++)
-            {
-                if (find(u_s, draw(s)) == -1)
-                {
-                    identical = false;
-                    break;
-                }
-            }
-            if (identical)
-            {
-                free(s->data);
-                free(s);
-                return u_s;
-            }
+            return u_s;
         }
+        i = (i + 1) & mask;
     }
 
-    assert(false && "Universe is full.");
     return NULL;
 }
 
+static set checkForIdenticalSetInUniverse(set s)
+{
+    struct universe_shard *u = &universe_of_discourse[shardIndex(s->hash)];
+    pthread_mutex_lock(&u->lock);
+
+    set u_s = findIdenticalSet(&u->table, s);
+    if (u_s != NULL)
+    {
+        pthread_mutex_unlock(&u->lock);
+        freeSet_(s);
+        END_CANDIDATE();
+        COUNT(intern_hits, 1);
+        return u_s;
+    }
+    COUNT(intern_misses, 1);
+
+    attachBits(s);
+    insertIntoTable(&u->table, s->hash, s);
+
+    uint64_t pointer_hash = hashPointer(s);
+    struct membership_shard *m = &universe_members[shardIndex(pointer_hash)];
+    pthread_rwlock_wrlock(&m->lock);
+    insertIntoTable(&m->table, pointer_hash, s);
+    pthread_rwlock_unlock(&m->lock);
+
+    __atomic_add_fetch(&generations[s->generation].population, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&u->lock);
+    END_CANDIDATE();
+    return s;
+}
+
 set addToSet(set s, void *object)
 {
     assert(isObjectASet(s));
 
-    if (find(s, object) != -1)
+    if (contains(s, object))
         return s;
 
-    unsigned int size = 0;
-    if (find(s, NULL) == -1)
-    {
-        size = s->size * ((s->size % DEFAULT_SET_SIZE) * 2);
-    }
-    else
-    {
-        size = s->size;
-    }
-
-    set new_set = Set_(size);
-    memcpy(new_set->data, s->data, s->size * sizeof(void *));
-    new_set->data[find(new_set, NULL)] = object;
+    set new_set = Set_(s->cardinality + 1);
+    memcpy(new_set->data, s->data, s->cardinality * sizeof(void *));
+    new_set->cardinality = s->cardinality;
+    insertSorted(new_set, object);
+    new_set->hash = s->hash + hashPointer(object);
 
     return checkForIdenticalSetInUniverse(new_set);
 }
@@ -146,19 +637,22 @@ set addToSet(set s, void *object)
 bool isElementOf(set s, void *object)
 {
     assert(isObjectASet(s));
-    return (find(s, object) != -1);
+    return contains(s, object);
 }
 
 set removeFromSet(set s, void *object)
 {
     assert(isObjectASet(s));
 
-    if (find(s, object) == -1)
+    long int i = find(s, object);
+    if (i == -1)
         return s;
 
-    set new_set = Set_(s->size);
-    memcpy(new_set->data, s->data, s->size * sizeof(void *));
-    new_set->data[find(new_set, object)] = NULL;
+    set new_set = Set_(s->cardinality - 1);
+    memcpy(new_set->data, s->data, (size_t)i * sizeof(void *));
+    memcpy(new_set->data + i, s->data + i + 1, (s->cardinality - (size_t)i - 1) * sizeof(void *));
+    new_set->cardinality = s->cardinality - 1;
+    new_set->hash = s->hash - hashPointer(object);
 
     return checkForIdenticalSetInUniverse(new_set);
 }
@@ -166,7 +660,81 @@ set removeFromSet(set s, void *object)
 unsigned int getCardinality(set s)
 {
     assert(isObjectASet(s));
-    return (unsigned int)find(s, NULL);
+    return s->cardinality;
+}
+
+/* a single pass over both sorted arrays; the flags pick which of the three regions of the
+   venn diagram survive, size bounds the result */
+static set mergeSets(set s, set t, unsigned int size, bool only_s, bool both, bool only_t)
+{
+    set new_set = Set_(size);
+    unsigned int i = 0;
+    unsigned int j = 0;
+    while (i < s->cardinality && j < t->cardinality)
+    {
+        void *a = s->data[i];
+        void *b = t->data[j];
+        if (precedes(a, b))
+        {
+            if (only_s)
+                new_set->data[new_set->cardinality++] = a;
+            i++;
+        }
+        else if (precedes(b, a))
+        {
+            if (only_t)
+                new_set->data[new_set->cardinality++] = b;
+            j++;
+        }
+        else
+        {
+            if (both)
+                new_set->data[new_set->cardinality++] = a;
+            i++;
+            j++;
+        }
+    }
+
+    if (only_s)
+    {
+        memcpy(new_set->data + new_set->cardinality, s->data + i, (s->cardinality - i) * sizeof(void *));
+        new_set->cardinality += s->cardinality - i;
+    }
+    if (only_t)
+    {
+        memcpy(new_set->data + new_set->cardinality, t->data + j, (t->cardinality - j) * sizeof(void *));
+        new_set->cardinality += t->cardinality - j;
+    }
+    trimSet_(new_set, size);
+    new_set->hash = hashSet(new_set);
+
+    return checkForIdenticalSetInUniverse(new_set);
+}
+
+/* the indices come out in ascending order, and with them the addresses */
+static set setFromBits(const struct set_domain *d, const uint64_t *bits, unsigned int words)
+{
+    unsigned int cardinality = 0;
+    for (unsigned int w = 0; w < words; w++)
+    {
+        cardinality += (unsigned int)__builtin_popcountll(bits[w]);
+    }
+
+    set new_set = Set_(cardinality);
+    for (unsigned int w = 0; w < words; w++)
+    {
+        uint64_t word = bits[w];
+        while (word != 0)
+        {
+            unsigned int index = w * BITS_PER_WORD + (unsigned int)__builtin_ctzll(word);
+            new_set->data[new_set->cardinality++] = d->base + index * d->stride;
+            word &= word - 1;
+        }
+    }
+    new_set->hash = hashSet(new_set);
+
+    COUNT(bitset_operations, 1);
+    return checkForIdenticalSetInUniverse(new_set);
 }
 
 set unionSet(set s, set t)
@@ -174,18 +742,525 @@ set unionSet(set s, set t)
     assert(isObjectASet(s));
     assert(isObjectASet(t));
 
-    set new_set = Set_(s->size + t->size);
-    for (unsigned int i = 0; i < s->size; i++)
+    if (s == t || t->cardinality == 0)
+        return s;
+    if (s->cardinality == 0)
+        return t;
+
+    if (shareDomain(s, t))
     {
-        memcpy(new_set->data, s->data, s->size * sizeof(void *));
+        uint64_t bits[MAX_SET_BITMAP_WORDS];
+        unsigned int words = (s->words > t->words) ? s->words : t->words;
+        for (unsigned int w = 0; w < words; w++)
+        {
+            bits[w] = wordOf(s, w) | wordOf(t, w);
+        }
+        return setFromBits(s->domain, bits, words);
     }
-    for (unsigned int i = 0; i < t->size; i++)
+
+    return mergeSets(s, t, s->cardinality + t->cardinality, true, true, true);
+}
+
+set intersectionSet(set s, set t)
+{
+    assert(isObjectASet(s));
+    assert(isObjectASet(t));
+
+    if (s == t)
+        return s;
+
+    if (shareDomain(s, t))
+    {
+        uint64_t bits[MAX_SET_BITMAP_WORDS];
+        unsigned int words = (s->words < t->words) ? s->words : t->words;
+        for (unsigned int w = 0; w < words; w++)
+        {
+            bits[w] = s->bits[w] & t->bits[w];
+        }
+        return setFromBits(s->domain, bits, words);
+    }
+
+    unsigned int size = (s->cardinality < t->cardinality) ? s->cardinality : t->cardinality;
+    return mergeSets(s, t, size, false, true, false);
+}
+
+set differenceSet(set s, set t)
+{
+    assert(isObjectASet(s));
+    assert(isObjectASet(t));
+
+    if (s->cardinality == 0 || t->cardinality == 0)
+        return s;
+
+    if (shareDomain(s, t))
+    {
+        uint64_t bits[MAX_SET_BITMAP_WORDS];
+        for (unsigned int w = 0; w < s->words; w++)
+        {
+            bits[w] = s->bits[w] & ~wordOf(t, w);
+        }
+        return setFromBits(s->domain, bits, s->words);
+    }
+
+    return mergeSets(s, t, s->cardinality, true, false, false);
+}
+
+bool isSubsetOf(set s, set t)
+{
+    assert(isObjectASet(s));
+    assert(isObjectASet(t));
+
+    if (s == t || s->cardinality == 0)
+        return true;
+    if (s->cardinality > t->cardinality)
+        return false;
+
+    if (shareDomain(s, t))
+    {
+        for (unsigned int w = 0; w < s->words; w++)
+        {
+            if ((s->bits[w] & ~wordOf(t, w)) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    unsigned int j = 0;
+    for (unsigned int i = 0; i < s->cardinality; i++)
+    {
+        while (j < t->cardinality && precedes(t->data[j], s->data[i]))
+            j++;
+        if (j == t->cardinality || t->data[j] != s->data[i])
+            return false;
+        j++;
+    }
+
+    return true;
+}
+
+bool areDisjoint(set s, set t)
+{
+    assert(isObjectASet(s));
+    assert(isObjectASet(t));
+
+    if (s->cardinality == 0 || t->cardinality == 0)
+        return true;
+    if (s == t)
+        return false;
+
+    if (shareDomain(s, t))
+    {
+        for (unsigned int w = 0; w < s->words && w < t->words; w++)
+        {
+            if ((s->bits[w] & t->bits[w]) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    unsigned int i = 0;
+    unsigned int j = 0;
+    while (i < s->cardinality && j < t->cardinality)
+    {
+        if (precedes(s->data[i], t->data[j]))
+            i++;
+        else if (precedes(t->data[j], s->data[i]))
+            j++;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+void registerSetDomain(void *base, unsigned int size, size_t stride, object_kind kind)
+{
+    assert(base != NULL && size > 0 && stride > 0);
+
+    pthread_mutex_lock(&domains_lock);
+    unsigned int n = domains_cardinality;
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (domains[i].base == base)
+        {
+            pthread_mutex_unlock(&domains_lock);
+            return;
+        }
+    }
+    assert(n < MAX_SET_DOMAINS && "Too many set domains.");
+
+    domains[n].base = base;
+    domains[n].stride = stride;
+    domains[n].size = size;
+    domains[n].kind = kind;
+    __atomic_store_n(&domains_cardinality, n + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&domains_lock);
+}
+
+set Sequence(object_kind kind, void *const *elements, unsigned int length)
+{
+    assert(kind != OBJECT_SET && kind != OBJECT_LETTER);
+    ensureUniverse();
+
+    set new_sequence = Set_(length);
+    memcpy(new_sequence->data, elements, length * sizeof(void *));
+    new_sequence->cardinality = length;
+    new_sequence->kind = (unsigned char)kind;
+    new_sequence->hash = hashSequence(new_sequence);
+
+    return checkForIdenticalSetInUniverse(new_sequence);
+}
+
+unsigned int getSequenceLength(set s)
+{
+    assert(isObjectASequence(s));
+    return s->cardinality;
+}
+
+void *const *getSequenceElements(set s)
+{
+    assert(isObjectASequence(s));
+    return s->data;
+}
+
+/* a range check for domain objects, one load from the header for everything else */
+object_kind getObjectKind(void *p)
+{
+    const struct set_domain *d = findDomain(p);
+    if (d != NULL)
+        return d->kind;
+
+    assert(lookupMember(p) != NULL && "Object is not managed by the universe.");
+    return (object_kind)((set)p)->kind;
+}
+
+void *getSetIndex(set s)
+{
+    assert(lookupMember(s) != NULL);
+    return __atomic_load_n(&s->lookup_index, __ATOMIC_ACQUIRE);
+}
+
+/* the first index attached wins, a thread that lost the race gets the winner back */
+void *attachSetIndex(set s, void *index)
+{
+    assert(lookupMember(s) != NULL);
+
+    void *expected = NULL;
+    if (__atomic_compare_exchange_n(&s->lookup_index, &expected, index, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return index;
+
+    free(index);
+    return expected;
+}
+
+set_builder SetBuilder(void)
+{
+    set_builder b = malloc(sizeof(struct set_builder_));
+    assert(b != NULL);
+    b->size = DEFAULT_SET_SIZE;
+    b->cardinality = 0;
+    b->data = malloc(b->size * sizeof(void *));
+    assert(b->data != NULL);
+    return b;
+}
+
+void addToSetBuilder(set_builder b, void *object)
+{
+    if (b->cardinality == b->size)
+    {
+        b->size *= 2;
+        b->data = realloc(b->data, b->size * sizeof(void *));
+        assert(b->data != NULL);
+    }
+
+    b->data[b->cardinality++] = object;
+}
+
+void addSetToSetBuilder(set_builder b, set s)
+{
+    assert(isObjectASet(s));
+
+    for (unsigned int i = 0; i < s->cardinality; i++)
+    {
+        addToSetBuilder(b, s->data[i]);
+    }
+}
+
+static int compareElements(const void *a, const void *b)
+{
+    const void *x = *(void *const *)a;
+    const void *y = *(void *const *)b;
+    return precedes(x, y) ? -1 : (precedes(y, x) ? 1 : 0);
+}
+
+set buildSet(set_builder b)
+{
+    ensureUniverse();
+    qsort(b->data, b->cardinality, sizeof(void *), compareElements);
+
+    set new_set = Set_(b->cardinality);
+    for (unsigned int i = 0; i < b->cardinality; i++)
     {
-        if (find(new_set, t->data[i]) == -1)
+        if (new_set->cardinality == 0 || new_set->data[new_set->cardinality - 1] != b->data[i])
         {
-            new_set->data[find(new_set, NULL)] = t->data[i];
+            new_set->data[new_set->cardinality++] = b->data[i];
         }
     }
+    trimSet_(new_set, b->cardinality);
+    new_set->hash = hashSet(new_set);
+
+    free(b->data);
+    free(b);
 
     return checkForIdenticalSetInUniverse(new_set);
-}
\ No newline at end of file
+}
+
+static void beginGeneration(void)
+{
+    pthread_mutex_lock(&generations_lock);
+    assert(__atomic_load_n(&candidates_in_flight, __ATOMIC_ACQUIRE) == 0 && "A generation is switched while a set is being interned.");
+
+    for (unsigned int i = 0; i < generations_size; i++)
+    {
+        if (generations[i].population == 0)
+        {
+            freeGeneration(&generations[i]);
+            current_generation = i;
+            __atomic_add_fetch(&generation_epoch, 1, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&generations_lock);
+            return;
+        }
+    }
+
+    generations = realloc(generations, (generations_size + 1) * sizeof(struct generation));
+    assert(generations != NULL);
+    generations[generations_size].blocks = NULL;
+    generations[generations_size].population = 0;
+    current_generation = generations_size;
+    generations_size++;
+    __atomic_add_fetch(&generation_epoch, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&generations_lock);
+}
+
+void beginSetGeneration(void)
+{
+    ensureUniverse();
+    beginGeneration();
+}
+
+/* sequences are rooted the same way, everything reachable from them survives */
+void markSetAsRoot(set s)
+{
+    assert(lookupMember(s) != NULL);
+
+    pthread_mutex_lock(&roots_lock);
+    if (roots_cardinality == roots_size)
+    {
+        roots_size = (roots_size == 0) ? DEFAULT_SET_SIZE : roots_size * 2;
+        roots = realloc(roots, roots_size * sizeof(set));
+        assert(roots != NULL);
+    }
+
+    roots[roots_cardinality++] = s;
+    pthread_mutex_unlock(&roots_lock);
+}
+
+void unmarkSetAsRoot(set s)
+{
+    pthread_mutex_lock(&roots_lock);
+    for (unsigned int i = 0; i < roots_cardinality; i++)
+    {
+        if (roots[i] == s)
+        {
+            roots[i] = roots[--roots_cardinality];
+            pthread_mutex_unlock(&roots_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&roots_lock);
+
+    assert(false && "Set is not a root.");
+}
+
+static void markFrom(set root, set **stack, unsigned int *stack_size)
+{
+    unsigned int top = 0;
+
+    if (root->marked)
+        return;
+    root->marked = true;
+    (*stack)[top++] = root;
+
+    while (top > 0)
+    {
+        set s = (*stack)[--top];
+        for (unsigned int i = 0; i < s->cardinality; i++)
+        {
+            void *e = s->data[i];
+            if (findMember(e) == NULL || ((set)e)->marked)
+                continue;
+
+            ((set)e)->marked = true;
+            if (top == *stack_size)
+            {
+                *stack_size *= 2;
+                *stack = realloc(*stack, *stack_size * sizeof(set));
+                assert(*stack != NULL);
+            }
+            (*stack)[top++] = e;
+        }
+    }
+}
+
+static unsigned int sizeForSurvivors(struct universe_table *t)
+{
+    unsigned int survivors = 0;
+    for (unsigned int i = 0; i < t->size; i++)
+    {
+        if (t->entries[i].s != NULL && t->entries[i].s->marked)
+            survivors++;
+    }
+
+    unsigned int size = DEFAULT_SHARD_SIZE;
+    while (2 * survivors >= size)
+        size *= 2;
+    return size;
+}
+
+void sweepUniverse(void)
+{
+    ensureUniverse();
+
+    /* every lock is taken in a fixed order, so the sweep sees a frozen universe */
+    pthread_mutex_lock(&roots_lock);
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
+        pthread_mutex_lock(&universe_of_discourse[i].lock);
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
+        pthread_rwlock_wrlock(&universe_members[i].lock);
+    pthread_mutex_lock(&generations_lock);
+    assert(__atomic_load_n(&candidates_in_flight, __ATOMIC_ACQUIRE) == 0 && "The universe is swept while a set is being interned.");
+
+    unsigned int stack_size = DEFAULT_SET_SIZE;
+    set *stack = malloc(stack_size * sizeof(set));
+    assert(stack != NULL);
+
+    /* the empty set is handed out by Set() and has to outlive every sweep */
+    markFrom(empty_set, &stack, &stack_size);
+    for (unsigned int i = 0; i < roots_cardinality; i++)
+    {
+        markFrom(roots[i], &stack, &stack_size);
+    }
+    free(stack);
+
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
+    {
+        struct universe_table *t = &universe_of_discourse[i].table;
+        for (unsigned int j = 0; j < t->size; j++)
+        {
+            set s = t->entries[j].s;
+            if (s != NULL && !s->marked)
+            {
+                generations[s->generation].population--;
+                free(s->lookup_index);
+            }
+        }
+    }
+
+    /* rebuild every index around the survivors, shrinking it if the universe thinned out */
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
+    {
+        struct universe_table *t = &universe_members[i].table;
+        resizeTable(t, sizeForSurvivors(t), true);
+    }
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
+    {
+        struct universe_table *t = &universe_of_discourse[i].table;
+        resizeTable(t, sizeForSurvivors(t), true);
+        for (unsigned int j = 0; j < t->size; j++)
+        {
+            if (t->entries[j].s != NULL)
+                t->entries[j].s->marked = false;
+        }
+    }
+
+    /* a generation without survivors is released as a whole */
+    for (unsigned int i = 0; i < generations_size; i++)
+    {
+        if (generations[i].population == 0 && i != current_generation)
+        {
+            freeGeneration(&generations[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&generations_lock);
+    for (unsigned int i = UNIVERSE_SHARDS; i > 0; i--)
+        pthread_rwlock_unlock(&universe_members[i - 1].lock);
+    for (unsigned int i = UNIVERSE_SHARDS; i > 0; i--)
+        pthread_mutex_unlock(&universe_of_discourse[i - 1].lock);
+    pthread_mutex_unlock(&roots_lock);
+}
+
+#ifdef SET_STATISTICS
+set_statistics getSetStatistics(void)
+{
+    ensureUniverse();
+    set_statistics result = statistics;
+
+    result.universe_cardinality = 0;
+    result.universe_size = 0;
+    result.elements = 0;
+    result.data_bytes = 0;
+    for (unsigned int i = 0; i < UNIVERSE_SHARDS; i++)
+    {
+        pthread_mutex_lock(&universe_of_discourse[i].lock);
+        struct universe_table *t = &universe_of_discourse[i].table;
+        result.universe_cardinality += t->cardinality;
+        result.universe_size += t->size;
+        for (unsigned int j = 0; j < t->size; j++)
+        {
+            if (t->entries[j].s != NULL)
+            {
+                result.elements += t->entries[j].s->cardinality;
+                result.data_bytes += sizeOfSet_(t->entries[j].s->cardinality);
+                if (t->entries[j].s->domain != NULL)
+                    result.data_bytes += t->entries[j].s->words * sizeof(uint64_t);
+            }
+        }
+        pthread_mutex_unlock(&universe_of_discourse[i].lock);
+    }
+
+    result.arena_bytes = 0;
+    pthread_mutex_lock(&generations_lock);
+    for (unsigned int i = 0; i < generations_size; i++)
+    {
+        for (struct arena_block *b = generations[i].blocks; b != NULL; b = b->next)
+        {
+            result.arena_bytes += b->size;
+        }
+    }
+    pthread_mutex_unlock(&generations_lock);
+
+    return result;
+}
+
+static double ratio(unsigned long a, unsigned long b)
+{
+    return (b == 0) ? 0.0 : (double)a / (double)b;
+}
+
+void printSetStatistics(void)
+{
+    set_statistics st = getSetStatistics();
+
+    wprintf(L"sets allocated:      %lu\n", st.sets_allocated);
+    wprintf(L"intern hits/misses:  %lu/%lu\n", st.intern_hits, st.intern_misses);
+    wprintf(L"universe occupancy:  %lu/%lu\n", st.universe_cardinality, st.universe_size);
+    wprintf(L"bytes in sets/arena: %lu/%lu\n", st.data_bytes, st.arena_bytes);
+    wprintf(L"average set size:    %.2f\n", ratio(st.elements, st.universe_cardinality));
+    wprintf(L"isObjectASet calls:  %lu (%.2f probes)\n", st.membership_checks, ratio(st.membership_probes, st.membership_checks));
+    wprintf(L"find calls:          %lu\n", st.find_calls);
+    wprintf(L"bitset operations:   %lu\n", st.bitset_operations);
+    wprintf(L"intern probes:       %.2f\n", ratio(st.intern_probes, st.intern_hits + st.intern_misses));
+}
+#endif
@@ -2,16 +2,86 @@
 #define SET_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+typedef enum object_kind_
+{
+    OBJECT_SET,
+    OBJECT_ORDERED_PAIR,
+    OBJECT_N_TUPLE,
+    OBJECT_WORD,
+    OBJECT_LETTER
+} object_kind;
 
 typedef struct set_ *set;
+typedef struct set_builder_ *set_builder;
+
+typedef struct set_iterator_
+{
+    void *const *elements;
+    unsigned int cardinality;
+    unsigned int index;
+} set_iterator;
 
 set Set(void);
 set addToSet(set s, void *object);
 bool isElementOf(set s, void *object);
 set removeFromSet(set s, void *object);
-void *drawFromSet(set s);
+void *drawFromSet(set s) __attribute__((deprecated("sets keep no cursor, use SetIterator")));
 unsigned int getCardinality(set s);
 set unionSet(set s, set t);
+set intersectionSet(set s, set t);
+set differenceSet(set s, set t);
+bool isSubsetOf(set s, set t);
+bool areDisjoint(set s, set t);
 bool isObjectASet(void *p);
 
+void registerSetDomain(void *base, unsigned int size, size_t stride, object_kind kind);
+object_kind getObjectKind(void *p);
+
+set Sequence(object_kind kind, void *const *elements, unsigned int length);
+bool isObjectASequence(void *p);
+unsigned int getSequenceLength(set s);
+void *const *getSequenceElements(set s);
+
+set_iterator SetIterator(set s);
+bool hasNextElement(set_iterator *it);
+void *nextElement(set_iterator *it);
+void *const *getElements(set s);
+
+void *getSetIndex(set s);
+void *attachSetIndex(set s, void *index);
+
+set_builder SetBuilder(void);
+void addToSetBuilder(set_builder b, void *object);
+void addSetToSetBuilder(set_builder b, set s);
+set buildSet(set_builder b);
+
+void beginSetGeneration(void);
+void markSetAsRoot(set s);
+void unmarkSetAsRoot(set s);
+void sweepUniverse(void);
+
+#ifdef SET_STATISTICS
+typedef struct set_statistics_
+{
+    unsigned long sets_allocated;
+    unsigned long intern_hits;
+    unsigned long intern_misses;
+    unsigned long intern_probes;
+    unsigned long membership_checks;
+    unsigned long membership_probes;
+    unsigned long find_calls;
+    unsigned long bitset_operations;
+    unsigned long universe_cardinality;
+    unsigned long universe_size;
+    unsigned long elements;
+    unsigned long data_bytes;
+    unsigned long arena_bytes;
+} set_statistics;
+
+set_statistics getSetStatistics(void);
+void printSetStatistics(void);
+#endif
+
 #endif // SET_H
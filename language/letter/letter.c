@@ -1,45 +1,146 @@
 #include "letter.h"
+#include "set.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
 
-wchar_t latin_alphabet_with_epsilon[SIZE_OF_LATIN_ALPHABET_WITH_EPSILON] = {L'a', L'b', L'c', L'd', L'e', L'f', L'g', L'h', L'i', L'j', L'k', L'l', L'm', L'n', L'o', L'p', L'q', L'r', L's', L't', L'u', L'v', L'w', L'x', L'y', L'z', L'0', L'1', L'2', L'3', L'4', L'5', L'6', L'7', L'8', L'9', L'ε', L'|', L'*', L'(', L')'};
-
-letter letter_a = latin_alphabet_with_epsilon + 0;
-letter letter_b = latin_alphabet_with_epsilon + 1;
-letter letter_c = latin_alphabet_with_epsilon + 2;
-letter letter_d = latin_alphabet_with_epsilon + 3;
-letter letter_e = latin_alphabet_with_epsilon + 4;
-letter letter_f = latin_alphabet_with_epsilon + 5;
-letter letter_g = latin_alphabet_with_epsilon + 6;
-letter letter_h = latin_alphabet_with_epsilon + 7;
-letter letter_i = latin_alphabet_with_epsilon + 8;
-letter letter_j = latin_alphabet_with_epsilon + 9;
-letter letter_k = latin_alphabet_with_epsilon + 10;
-letter letter_l = latin_alphabet_with_epsilon + 11;
-letter letter_m = latin_alphabet_with_epsilon + 12;
-letter letter_n = latin_alphabet_with_epsilon + 13;
-letter letter_o = latin_alphabet_with_epsilon + 14;
-letter letter_p = latin_alphabet_with_epsilon + 15;
-letter letter_q = latin_alphabet_with_epsilon + 16;
-letter letter_r = latin_alphabet_with_epsilon + 17;
-letter letter_s = latin_alphabet_with_epsilon + 18;
-letter letter_t = latin_alphabet_with_epsilon + 19;
-letter letter_u = latin_alphabet_with_epsilon + 20;
-letter letter_v = latin_alphabet_with_epsilon + 21;
-letter letter_w = latin_alphabet_with_epsilon + 22;
-letter letter_x = latin_alphabet_with_epsilon + 23;
-letter letter_y = latin_alphabet_with_epsilon + 24;
-letter letter_z = latin_alphabet_with_epsilon + 25;
-letter letter_0 = latin_alphabet_with_epsilon + 26;
-letter letter_1 = latin_alphabet_with_epsilon + 27;
-letter letter_2 = latin_alphabet_with_epsilon + 28;
-letter letter_3 = latin_alphabet_with_epsilon + 29;
-letter letter_4 = latin_alphabet_with_epsilon + 30;
-letter letter_5 = latin_alphabet_with_epsilon + 31;
-letter letter_6 = latin_alphabet_with_epsilon + 32;
-letter letter_7 = latin_alphabet_with_epsilon + 33;
-letter letter_8 = latin_alphabet_with_epsilon + 34;
-letter letter_9 = latin_alphabet_with_epsilon + 35;
-letter letter_epsilon = latin_alphabet_with_epsilon + 36;
-letter letter_bar = latin_alphabet_with_epsilon + 37;
-letter letter_star = latin_alphabet_with_epsilon + 38;
-letter letter_bracket_open = latin_alphabet_with_epsilon + 39;
-letter letter_bracket_closed = latin_alphabet_with_epsilon + 40;
+#define LETTER_PAGE_BITS 8
+#define LETTER_PAGE_SIZE (1u << LETTER_PAGE_BITS)
+#define LETTER_PAGES ((MAX_CODE_POINT >> LETTER_PAGE_BITS) + 1)
+#define LETTER_CHUNK_BITS 12
+#define LETTER_CHUNK_SIZE (1u << LETTER_CHUNK_BITS)
+#define LETTER_CHUNKS 9
+
+/* every letter ever seen, in the order it was first seen; the latin alphabet comes first.
+   The table grows in chunks that double in size, chunk k holds the codes from
+   LETTER_CHUNK_SIZE * (2^k - 1) on, so letters never move once they are handed out and
+   nine chunks cover every code point. Chunks are allocated on first use and each one is a
+   set domain of its own */
+static wchar_t *letter_chunks[LETTER_CHUNKS];
+static const wchar_t latin_alphabet_with_epsilon[SIZE_OF_LATIN_ALPHABET_WITH_EPSILON] = {L'a', L'b', L'c', L'd', L'e', L'f', L'g', L'h', L'i', L'j', L'k', L'l', L'm', L'n', L'o', L'p', L'q', L'r', L's', L't', L'u', L'v', L'w', L'x', L'y', L'z', L'0', L'1', L'2', L'3', L'4', L'5', L'6', L'7', L'8', L'9', L'ε', L'|', L'*', L'(', L')'};
+
+/* code point -> letter, one lazily allocated page per 256 code points; pages and their
+   entries are published with release stores, so lookups never take the lock */
+static letter *letter_pages[LETTER_PAGES];
+static unsigned int letter_table_cardinality = SIZE_OF_LATIN_ALPHABET_WITH_EPSILON;
+static pthread_mutex_t letter_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t letter_table_once = PTHREAD_ONCE_INIT;
+
+static unsigned int chunkOfCode(unsigned int code)
+{
+    return 31u - (unsigned int)__builtin_clz((code >> LETTER_CHUNK_BITS) + 1);
+}
+
+static unsigned int chunkStart(unsigned int chunk)
+{
+    return LETTER_CHUNK_SIZE * ((1u << chunk) - 1);
+}
+
+/* called with the lock held, or before any letter is handed out */
+static wchar_t *allocateLetterChunk(unsigned int chunk)
+{
+    wchar_t *letters = calloc(LETTER_CHUNK_SIZE << chunk, sizeof(wchar_t));
+    assert(letters != NULL);
+    registerSetDomain(letters, LETTER_CHUNK_SIZE << chunk, sizeof(wchar_t), OBJECT_LETTER);
+    __atomic_store_n(&letter_chunks[chunk], letters, __ATOMIC_RELEASE);
+    return letters;
+}
+
+static void mapLetter(unsigned int code_point, letter l)
+{
+    letter *page = letter_pages[code_point >> LETTER_PAGE_BITS];
+    if (page == NULL)
+    {
+        page = calloc(LETTER_PAGE_SIZE, sizeof(letter));
+        assert(page != NULL);
+        __atomic_store_n(&letter_pages[code_point >> LETTER_PAGE_BITS], page, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&page[code_point & (LETTER_PAGE_SIZE - 1)], l, __ATOMIC_RELEASE);
+}
+
+/* letters are then recognised by address, and sets of them are backed by a bitmap as long
+   as they stay among the first thousand letters seen */
+static void initializeLetterTable(void)
+{
+    wchar_t *letters = allocateLetterChunk(0);
+    for (unsigned int i = 0; i < SIZE_OF_LATIN_ALPHABET_WITH_EPSILON; i++)
+    {
+        letters[i] = latin_alphabet_with_epsilon[i];
+        mapLetter((unsigned int)letters[i], letters + i);
+    }
+}
+
+static void ensureLetterTable(void)
+{
+    pthread_once(&letter_table_once, initializeLetterTable);
+}
+
+/* the letter of a code point that was seen before, NULL for any other */
+letter findLetter(unsigned int code_point)
+{
+    if (code_point > MAX_CODE_POINT)
+        return NULL;
+
+    ensureLetterTable();
+    letter *page = __atomic_load_n(&letter_pages[code_point >> LETTER_PAGE_BITS], __ATOMIC_ACQUIRE);
+    if (page == NULL)
+        return NULL;
+
+    return __atomic_load_n(&page[code_point & (LETTER_PAGE_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+/* code points beyond unicode are not letters, they stand for the replacement character */
+letter Letter(unsigned int code_point)
+{
+    if (code_point > MAX_CODE_POINT)
+        code_point = REPLACEMENT_CHARACTER;
+
+    letter l = findLetter(code_point);
+    if (l != NULL)
+        return l;
+
+    pthread_mutex_lock(&letter_table_lock);
+    letter *page = letter_pages[code_point >> LETTER_PAGE_BITS];
+    l = (page != NULL) ? page[code_point & (LETTER_PAGE_SIZE - 1)] : NULL;
+    if (l == NULL)
+    {
+        unsigned int code = letter_table_cardinality++;
+        unsigned int chunk = chunkOfCode(code);
+        wchar_t *letters = letter_chunks[chunk];
+        if (letters == NULL)
+            letters = allocateLetterChunk(chunk);
+
+        l = letters + (code - chunkStart(chunk));
+        *l = (wchar_t)code_point;
+        mapLetter(code_point, l);
+    }
+    pthread_mutex_unlock(&letter_table_lock);
+
+    return l;
+}
+
+/* the position of l in the letter table, below SIZE_OF_LETTER_TABLE */
+unsigned int getLetterCode(letter l)
+{
+    for (unsigned int chunk = 0; chunk < LETTER_CHUNKS; chunk++)
+    {
+        wchar_t *letters = __atomic_load_n(&letter_chunks[chunk], __ATOMIC_ACQUIRE);
+        if (letters != NULL && l >= letters && l < letters + (LETTER_CHUNK_SIZE << chunk))
+            return chunkStart(chunk) + (unsigned int)(l - letters);
+    }
+
+    assert(false && "Not a letter.");
+    return SIZE_OF_LETTER_TABLE;
+}
+
+letter getLetterByCode(unsigned int code)
+{
+    assert(code < SIZE_OF_LETTER_TABLE);
+    ensureLetterTable();
+
+    unsigned int chunk = chunkOfCode(code);
+    wchar_t *letters = __atomic_load_n(&letter_chunks[chunk], __ATOMIC_ACQUIRE);
+    assert(letters != NULL);
+    return letters + (code - chunkStart(chunk));
+}
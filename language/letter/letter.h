@@ -4,51 +4,58 @@
 #include <wchar.h>
 
 #define SIZE_OF_LATIN_ALPHABET_WITH_EPSILON 41
+#define MAX_CODE_POINT 0x10FFFF
+#define SIZE_OF_LETTER_TABLE (MAX_CODE_POINT + 1)
+#define REPLACEMENT_CHARACTER 0xFFFD
 
 typedef wchar_t *letter;
 
-extern wchar_t latin_alphabet_with_epsilon[SIZE_OF_LATIN_ALPHABET_WITH_EPSILON];
+letter Letter(unsigned int code_point);
+letter findLetter(unsigned int code_point);
+unsigned int getLetterCode(letter l);
+letter getLetterByCode(unsigned int code);
 
-extern letter letter_a;
-extern letter letter_b;
-extern letter letter_c;
-extern letter letter_d;
-extern letter letter_e;
-extern letter letter_f;
-extern letter letter_g;
-extern letter letter_h;
-extern letter letter_i;
-extern letter letter_j;
-extern letter letter_k;
-extern letter letter_l;
-extern letter letter_m;
-extern letter letter_n;
-extern letter letter_o;
-extern letter letter_p;
-extern letter letter_q;
-extern letter letter_r;
-extern letter letter_s;
-extern letter letter_t;
-extern letter letter_u;
-extern letter letter_v;
-extern letter letter_w;
-extern letter letter_x;
-extern letter letter_y;
-extern letter letter_z;
-extern letter letter_0;
-extern letter letter_1;
-extern letter letter_2;
-extern letter letter_3;
-extern letter letter_4;
-extern letter letter_5;
-extern letter letter_6;
-extern letter letter_7;
-extern letter letter_8;
-extern letter letter_9;
-extern letter letter_epsilon;
-extern letter letter_bar;
-extern letter letter_star;
-extern letter letter_bracket_open;
-extern letter letter_bracket_closed;
+/* the latin alphabet takes the first codes, in this order */
+#define letter_a getLetterByCode(0)
+#define letter_b getLetterByCode(1)
+#define letter_c getLetterByCode(2)
+#define letter_d getLetterByCode(3)
+#define letter_e getLetterByCode(4)
+#define letter_f getLetterByCode(5)
+#define letter_g getLetterByCode(6)
+#define letter_h getLetterByCode(7)
+#define letter_i getLetterByCode(8)
+#define letter_j getLetterByCode(9)
+#define letter_k getLetterByCode(10)
+#define letter_l getLetterByCode(11)
+#define letter_m getLetterByCode(12)
+#define letter_n getLetterByCode(13)
+#define letter_o getLetterByCode(14)
+#define letter_p getLetterByCode(15)
+#define letter_q getLetterByCode(16)
+#define letter_r getLetterByCode(17)
+#define letter_s getLetterByCode(18)
+#define letter_t getLetterByCode(19)
+#define letter_u getLetterByCode(20)
+#define letter_v getLetterByCode(21)
+#define letter_w getLetterByCode(22)
+#define letter_x getLetterByCode(23)
+#define letter_y getLetterByCode(24)
+#define letter_z getLetterByCode(25)
+#define letter_0 getLetterByCode(26)
+#define letter_1 getLetterByCode(27)
+#define letter_2 getLetterByCode(28)
+#define letter_3 getLetterByCode(29)
+#define letter_4 getLetterByCode(30)
+#define letter_5 getLetterByCode(31)
+#define letter_6 getLetterByCode(32)
+#define letter_7 getLetterByCode(33)
+#define letter_8 getLetterByCode(34)
+#define letter_9 getLetterByCode(35)
+#define letter_epsilon getLetterByCode(36)
+#define letter_bar getLetterByCode(37)
+#define letter_star getLetterByCode(38)
+#define letter_bracket_open getLetterByCode(39)
+#define letter_bracket_closed getLetterByCode(40)
 
 #endif
@@ -1,19 +1,39 @@
 #include "word.h"
 #include "letter.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#define PRINT_BUFFER_SIZE 1024
+
+/* letters of a decoded word are staged on the heap, inputs can be far larger than the stack */
+static void **Letters(size_t length)
+{
+    void **letters = malloc((length + 1) * sizeof(void *));
+    assert(letters != NULL);
+    return letters;
+}
+
+static word wordFromLetters(void **letters, size_t length)
+{
+    assert(length <= UINT_MAX);
+    word w = Sequence(OBJECT_WORD, letters, (unsigned int)length);
+    free(letters);
+    return w;
+}
 
 word Word(unsigned int n, ...)
 {
     va_list args;
     va_start(args, n);
 
-    unsigned int total_length = 0;
+    size_t total_length = 0;
     for (unsigned int i = 0; i < n; i++)
     {
         void *w_or_l = va_arg(args, void *);
-        if (w_or_l >= (void *)latin_alphabet_with_epsilon && w_or_l < (void *)(latin_alphabet_with_epsilon + SIZE_OF_LATIN_ALPHABET_WITH_EPSILON))
+        if (getObjectKind(w_or_l) == OBJECT_LETTER)
         {
             total_length++;
         }
@@ -26,18 +46,17 @@ word Word(unsigned int n, ...)
 
     va_end(args);
 
-    void *contents[(total_length + 1)];
-    contents[0] = &total_length;
+    void **letters = Letters(total_length);
 
     va_start(args, n);
 
-    unsigned int index = 1;
+    size_t index = 0;
     for (unsigned int i = 0; i < n; i++)
     {
         void *w_or_l = va_arg(args, void *);
-        if (w_or_l >= (void *)latin_alphabet_with_epsilon && w_or_l < (void *)(latin_alphabet_with_epsilon + SIZE_OF_LATIN_ALPHABET_WITH_EPSILON))
+        if (getObjectKind(w_or_l) == OBJECT_LETTER)
         {
-            contents[index] = w_or_l;
+            letters[index] = w_or_l;
             index++;
         }
         else
@@ -45,7 +64,7 @@ word Word(unsigned int n, ...)
             word w = (word)w_or_l;
             for (unsigned int j = 0; j < getLength(w); j++)
             {
-                contents[index] = getObjectByIndex(w, j);
+                letters[index] = getObjectByIndex(w, j);
                 index++;
             }
         }
@@ -53,89 +72,305 @@ word Word(unsigned int n, ...)
 
     va_end(args);
 
-    n_tuple w = NTupleFromVoidPointerArray(contents);
-    return w;
+    return wordFromLetters(letters, total_length);
 }
 
-void print(const wchar_t *format, ...)
+print_buffer PrintBuffer(FILE *out, wchar_t *data, size_t size)
 {
-    long unsigned int format_length = wcslen(format);
+    assert(data != NULL && size > 0);
+
+    print_buffer b;
+    b.out = out;
+    b.data = data;
+    b.size = size;
+    b.length = 0;
+    return b;
+}
+
+/* one slot always stays free for the terminator; without a stream, characters that do not
+   fit are only counted, like snprintf does */
+static void putToBuffer(print_buffer *b, wchar_t c)
+{
+    if (b->out != NULL && b->length + 1 >= b->size)
+        flushPrintBuffer(b);
+
+    if (b->length + 1 < b->size)
+        b->data[b->length] = c;
+    b->length++;
+}
 
+/* a word that does not fit next to what is buffered already is written on its own, through a
+   buffer of its own size if it is larger than this one */
+static void putWordToBuffer(print_buffer *b, word w)
+{
+    size_t length = getLength(w);
+    if (b->out != NULL && b->length + length + 1 > b->size)
+    {
+        flushPrintBuffer(b);
+        if (length + 1 > b->size)
+        {
+            wchar_t *data = malloc((length + 1) * sizeof(wchar_t));
+            assert(data != NULL);
+            print_buffer large = PrintBuffer(b->out, data, length + 1);
+            large.length = encodeWord(w, data, length + 1);
+            flushPrintBuffer(&large);
+            free(data);
+            return;
+        }
+    }
+
+    bool full = b->length >= b->size;
+    b->length += encodeWord(w, full ? b->data : b->data + b->length, full ? 0 : b->size - b->length);
+}
+
+static void putNumberToBuffer(print_buffer *b, const wchar_t *format, ...)
+{
+    wchar_t digits[32];
     va_list args;
     va_start(args, format);
+    int length = vswprintf(digits, 32, format, args);
+    va_end(args);
+    for (int k = 0; k < length; k++)
+    {
+        putToBuffer(b, digits[k]);
+    }
+}
+
+void vprintToBuffer(print_buffer *b, const wchar_t *format, va_list args)
+{
+    long unsigned int format_length = wcslen(format);
 
     for (unsigned int i = 0; i < format_length; i++)
     {
-        if (i < (format_length - 2) && format[i] == '%' && format[i + 1] == 'l' && format[i + 2] == 'w')
+        if (i + 2 < format_length && format[i] == '%' && format[i + 1] == 'l' && format[i + 2] == 'w')
         {
-            word w = va_arg(args, word);
-            for (unsigned int j = 0; j < getLength(w); j++)
-            {
-                letter l = getObjectByIndex(w, j);
-                wprintf(L"%lc", *l);
-            }
+            putWordToBuffer(b, va_arg(args, word));
             i += 2;
         }
-        else if (i < (format_length - 2) && format[i] == '%' && format[i + 1] == 'l' && format[i + 2] == 'l')
+        else if (i + 2 < format_length && format[i] == '%' && format[i + 1] == 'l' && format[i + 2] == 'l')
         {
-            wprintf(L"%lc", *va_arg(args, letter));
+            putToBuffer(b, *va_arg(args, letter));
             i += 2;
         }
-        else if (i < (format_length - 1) && format[i] == '%' && format[i + 1] == 'u')
+        else if (i + 1 < format_length && format[i] == '%' && format[i + 1] == 'u')
         {
-            wprintf(L"%u", va_arg(args, unsigned int));
+            putNumberToBuffer(b, L"%lu", (long unsigned int)va_arg(args, unsigned int));
+            i += 1;
         }
-        else if (i < (format_length - 1) && format[i] == '%' && format[i + 1] == 'd')
+        else if (i + 1 < format_length && format[i] == '%' && format[i + 1] == 'd')
         {
-            wprintf(L"%u", va_arg(args, int));
+            putNumberToBuffer(b, L"%ld", (long int)va_arg(args, int));
+            i += 1;
         }
         else
         {
-            wprintf(L"%lc", format[i]);
+            putToBuffer(b, format[i]);
         }
     }
+}
 
+void printToBuffer(print_buffer *b, const wchar_t *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintToBuffer(b, format, args);
     va_end(args);
 }
 
-word wordFromString(const wchar_t *str)
+/* writes the buffer out in one go, a letter for code point zero is the only thing that
+   splits it */
+void flushPrintBuffer(print_buffer *b)
 {
-    size_t length = wcslen(str);
-    void *contents[(length + 1)];
-    contents[0] = &length;
-    for (unsigned int i = 0; i < length; i++)
+    size_t length = (b->length < b->size) ? b->length : b->size - 1;
+    b->data[length] = L'\0';
+    if (b->out == NULL)
+        return;
+
+    for (size_t i = 0; i < length;)
     {
-        if (str[i] >= 97 && str[i] <= 122)
+        fputws(b->data + i, b->out);
+        i += wcslen(b->data + i);
+        if (i < length)
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + (str[i] - 97));
+            fputwc(L'\0', b->out);
+            i++;
         }
-        else if (str[i] >= 48 && str[i] <= 57)
+    }
+    b->length = 0;
+}
+
+void print(const wchar_t *format, ...)
+{
+    wchar_t data[PRINT_BUFFER_SIZE];
+    print_buffer b = PrintBuffer(stdout, data, PRINT_BUFFER_SIZE);
+
+    va_list args;
+    va_start(args, format);
+    vprintToBuffer(&b, format, args);
+    va_end(args);
+
+    flushPrintBuffer(&b);
+}
+
+size_t encodeWord(word w, wchar_t *out, size_t size)
+{
+    unsigned int length = getLength(w);
+    void *const *letters = getSequenceElements(w);
+    for (unsigned int j = 0; j < length && j + 1 < size; j++)
+    {
+        out[j] = *(letter)letters[j];
+    }
+    if (size > 0)
+        out[(length < size) ? length : size - 1] = L'\0';
+
+    return length;
+}
+
+/* the number of bytes the whole encoding needs, of which at most size - 1 are written */
+size_t encodeWordUTF8(word w, char *out, size_t size)
+{
+    unsigned int length = getLength(w);
+    void *const *letters = getSequenceElements(w);
+    size_t n = 0;
+    for (unsigned int j = 0; j < length; j++)
+    {
+        unsigned int c = (unsigned int)*(letter)letters[j];
+        unsigned char bytes[4];
+        unsigned int count;
+        if (c < 0x80)
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + 26 + (str[i] - 48));
+            bytes[0] = (unsigned char)c;
+            count = 1;
         }
-        else if (str[i] == L'ε')
+        else if (c < 0x800)
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + 36);
+            bytes[0] = (unsigned char)(0xC0 | (c >> 6));
+            bytes[1] = (unsigned char)(0x80 | (c & 0x3F));
+            count = 2;
         }
-        else if (str[i] == L'|')
+        else if (c < 0x10000)
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + 37);
+            bytes[0] = (unsigned char)(0xE0 | (c >> 12));
+            bytes[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[2] = (unsigned char)(0x80 | (c & 0x3F));
+            count = 3;
         }
-        else if (str[i] == L'*')
+        else
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + 38);
+            bytes[0] = (unsigned char)(0xF0 | (c >> 18));
+            bytes[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+            bytes[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[3] = (unsigned char)(0x80 | (c & 0x3F));
+            count = 4;
         }
-        else if (str[i] == L'(')
+
+        for (unsigned int k = 0; k < count; k++, n++)
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + 39);
+            if (n + 1 < size)
+                out[n] = (char)bytes[k];
         }
-        else if (str[i] == L')')
+    }
+    if (size > 0)
+        out[(n < size) ? n : size - 1] = '\0';
+
+    return n;
+}
+
+word wordFromString(const wchar_t *str)
+{
+    size_t length = wcslen(str);
+    void **letters = Letters(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        letters[i] = Letter((unsigned int)str[i]);
+    }
+
+    return wordFromLetters(letters, length);
+}
+
+/* the length of the sequence a lead byte starts; 0 for continuation bytes and for bytes that
+   never occur in utf-8 (c0, c1 would only start overlong sequences, f5 and up exceed u+10ffff) */
+static const unsigned char utf8_sequence_length[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+unsigned int getUTF8SequenceLength(unsigned char lead)
+{
+    return utf8_sequence_length[lead];
+}
+
+/* smallest code point that needs a sequence of each length, anything below is overlong */
+static const unsigned int utf8_minimum[5] = {0, 0, 0x80, 0x800, 0x10000};
+
+/* decodes the sequence at bytes[*i] and advances *i past it; a malformed sequence
+   becomes u+fffd and only its first byte is consumed */
+unsigned int decodeUTF8(const unsigned char *bytes, size_t length, size_t *i)
+{
+    unsigned char lead = bytes[*i];
+    unsigned int n = utf8_sequence_length[lead];
+    if (n == 1)
+    {
+        (*i)++;
+        return lead;
+    }
+
+    if (n == 0 || length - *i < n)
+    {
+        (*i)++;
+        return REPLACEMENT_CHARACTER;
+    }
+
+    unsigned int code_point = lead & (0x7Fu >> n);
+    for (unsigned int k = 1; k < n; k++)
+    {
+        unsigned char next = bytes[*i + k];
+        if ((next & 0xC0) != 0x80)
         {
-            contents[i + 1] = (void *)(latin_alphabet_with_epsilon + 40);
+            (*i)++;
+            return REPLACEMENT_CHARACTER;
         }
+        code_point = (code_point << 6) | (next & 0x3Fu);
     }
-    n_tuple w = NTupleFromVoidPointerArray(contents);
-    return w;
+
+    if (code_point < utf8_minimum[n] || code_point > MAX_CODE_POINT || (code_point >= 0xD800 && code_point <= 0xDFFF))
+    {
+        (*i)++;
+        return REPLACEMENT_CHARACTER;
+    }
+
+    *i += n;
+    return code_point;
+}
+
+word wordFromUTF8(const char *bytes, size_t length)
+{
+    const unsigned char *b = (const unsigned char *)bytes;
+    void **letters = Letters(length);
+    size_t n = 0;
+    for (size_t i = 0; i < length;)
+    {
+        letters[n++] = Letter(decodeUTF8(b, length, &i));
+    }
+
+    return wordFromLetters(letters, n);
+}
+
+/* every byte is its own letter, the one of the code point with the same value */
+word wordFromBytes(const unsigned char *bytes, size_t length)
+{
+    void **letters = Letters(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        letters[i] = Letter(bytes[i]);
+    }
+
+    return wordFromLetters(letters, length);
 }
 
 letter getLetterByIndex(word w, unsigned int idx)
@@ -149,12 +384,64 @@ word getSubword(word w, unsigned int start, unsigned int end)
     assert(start <= end);
     assert(end <= getLength(w));
     unsigned int length = end - start;
-    void *contents[(length + 1)];
-    contents[0] = &length;
+    void **letters = Letters(length);
     for (unsigned int i = 0; i < length; i++)
     {
-        contents[i + 1] = getObjectByIndex(w, start + i);
+        letters[i] = getObjectByIndex(w, start + i);
     }
-    n_tuple subword = NTupleFromVoidPointerArray(contents);
+
+    return wordFromLetters(letters, length);
+}
+
+/* the codes are packed once per word and kept with it for as long as the word lives */
+packed_word PackedWord(word w)
+{
+    packed_word p;
+    p.length = getLength(w);
+    p.codes = getSetIndex(w);
+    if (p.codes != NULL)
+        return p;
+
+    unsigned int *codes = malloc((p.length + 1) * sizeof(unsigned int));
+    assert(codes != NULL);
+    for (unsigned int i = 0; i < p.length; i++)
+    {
+        codes[i] = getLetterCode(getObjectByIndex(w, i));
+    }
+
+    p.codes = attachSetIndex(w, codes);
+    return p;
+}
+
+unsigned int getPackedLength(packed_word w)
+{
+    return w.length;
+}
+
+letter getPackedLetterByIndex(packed_word w, unsigned int idx)
+{
+    assert(idx < w.length);
+    return getLetterByCode(w.codes[idx]);
+}
+
+packed_word getPackedSubword(packed_word w, unsigned int start, unsigned int end)
+{
+    assert(start <= end);
+    assert(end <= w.length);
+
+    packed_word subword;
+    subword.codes = w.codes + start;
+    subword.length = end - start;
     return subword;
 }
+
+word wordFromPackedWord(packed_word w)
+{
+    void **letters = Letters(w.length);
+    for (unsigned int i = 0; i < w.length; i++)
+    {
+        letters[i] = getLetterByCode(w.codes[i]);
+    }
+
+    return wordFromLetters(letters, w.length);
+}
@@ -3,14 +3,48 @@
 
 #include "letter.h"
 #include "n_tuple.h"
+#include <stdarg.h>
+#include <stdio.h>
 #include <wchar.h>
 
 typedef n_tuple word;
 
+/* collects output and writes it to out in large blocks; out may be NULL for a plain buffer */
+typedef struct print_buffer_
+{
+    FILE *out;
+    wchar_t *data;
+    size_t size;
+    size_t length;
+} print_buffer;
+
+/* a run of letter codes; views into the same word share its buffer */
+typedef struct packed_word_
+{
+    const unsigned int *codes;
+    unsigned int length;
+} packed_word;
+
 word Word(unsigned int n, ...);
 word wordFromString(const wchar_t *str);
+word wordFromUTF8(const char *bytes, size_t length);
+word wordFromBytes(const unsigned char *bytes, size_t length);
+unsigned int decodeUTF8(const unsigned char *bytes, size_t length, size_t *i);
+unsigned int getUTF8SequenceLength(unsigned char lead);
 void print(const wchar_t *format, ...);
+print_buffer PrintBuffer(FILE *out, wchar_t *data, size_t size);
+void printToBuffer(print_buffer *b, const wchar_t *format, ...);
+void vprintToBuffer(print_buffer *b, const wchar_t *format, va_list args);
+void flushPrintBuffer(print_buffer *b);
+size_t encodeWord(word w, wchar_t *out, size_t size);
+size_t encodeWordUTF8(word w, char *out, size_t size);
 letter getLetterByIndex(word, unsigned int);
 word getSubword(word, unsigned int, unsigned int);
 
+packed_word PackedWord(word w);
+unsigned int getPackedLength(packed_word w);
+letter getPackedLetterByIndex(packed_word w, unsigned int idx);
+packed_word getPackedSubword(packed_word w, unsigned int start, unsigned int end);
+word wordFromPackedWord(packed_word w);
+
 #endif
@@ -1,6 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "nondeterministic_finite_automaton.h"
+#include "graph.h"
 #include <assert.h>
 #include <locale.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 void regexNFATest(void)
 {
@@ -34,10 +41,491 @@ void regexNFATest(void)
     print(L"Regex (ab|cd)*(ef|gh) NFA test successful\n\n");
 }
 
+void unicodeRegexNFATest(void)
+{
+    // Letters outside the latin alphabet, decoded from utf-8 and from raw bytes
+    nondeterministic_finite_automaton nfa = regexNFA(wordFromUTF8("(\xc3\xa9|\xe2\x82\xac)*x", 10));
+
+    bool res = runNFA(nfa, wordFromUTF8("\xc3\xa9\xe2\x82\xac\xc3\xa9x", 8));
+    (void)res;
+    assert(res == true);
+    res = runNFA(nfa, wordFromString(L"x"));
+    assert(res == true);
+    res = runNFA(nfa, wordFromUTF8("\xc3x", 2));
+    assert(res == false);
+    res = runNFA(nfa, wordFromBytes((const unsigned char *)"\xe9x", 2));
+    assert(res == true);
+
+    // Letters are only made on demand, and nothing beyond unicode becomes one
+    assert(findLetter(0x10FFFE) == NULL);
+    assert(*Letter(0x10FFFE) == 0x10FFFE && findLetter(0x10FFFE) == Letter(0x10FFFE));
+    assert(Letter(MAX_CODE_POINT + 1) == Letter(REPLACEMENT_CHARACTER));
+
+    print(L"Unicode regex NFA test successful\n\n");
+}
+
+void streamingRegexNFATest(void)
+{
+    // Input arrives in pieces, the second one splits a utf-8 sequence
+    nondeterministic_finite_automaton nfa = regexNFA(wordFromString(L"(ab|cd)*(ef|g\u00e9)"));
+
+    nfa_matcher m = NFAMatcher(nfa);
+    feedNFAMatcher(&m, "abcd", 4);
+    feedNFAMatcher(&m, "g\xc3", 2);
+    feedNFAMatcher(&m, "\xa9", 1);
+    bool res = finishNFAMatcher(&m);
+    (void)res;
+    assert(res == true);
+
+    m = NFAMatcher(nfa);
+    feedNFAMatcherWide(&m, L"cdab", 4);
+    feedNFAMatcher(&m, "g\xc3", 2);
+    res = finishNFAMatcher(&m);
+    assert(res == false);
+
+    res = runNFAOnBuffer(nfa, "abef", 4);
+    assert(res == true);
+
+    // Unknown code points reject without becoming letters
+    m = NFAMatcher(nfa);
+    feedNFAMatcher(&m, "ab\xf4\x8f\xbf\xb0" "ef", 8);
+    res = finishNFAMatcher(&m);
+    assert(res == false && findLetter(0x10FFF0) == NULL);
+
+    // Files are read through, a descriptor that cannot be read is reported
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    fputs("cdabg\xc3\xa9", file);
+    rewind(file);
+    nfa_result result = runNFAOnFile(nfa, file);
+    (void)result;
+    assert(result == NFA_ACCEPTED);
+    fclose(file);
+    result = runNFAOnDescriptor(nfa, -1);
+    assert(result == NFA_READ_ERROR);
+
+    print(L"Streaming regex NFA test successful\n\n");
+}
+
+void compiledRegexNFATest(void)
+{
+    // States are numbered densely, the tuple stays available for inspection
+    nondeterministic_finite_automaton nfa = regexNFA(wordFromString(L"(ab|cd)*(ef|gh)"));
+    compiled_nfa c = compileNFA(nfa);
+
+    (void)c;
+    assert(compileNFA(nfa) == c && getCompiledNFATuple(c) == nfa);
+    assert(getCompiledStateCount(c) == getCardinality(getObjectByIndex(nfa, 0)));
+    assert(getCompiledState(c, getCompiledStart(c)) == getObjectByIndex(nfa, 3));
+    for (unsigned int id = 0; id < getCompiledStateCount(c); id++)
+    {
+        word state = getCompiledState(c, id);
+        (void)state;
+        assert(getCompiledStateId(c, state) == id);
+        assert(isCompiledStateFinal(c, id) == isElementOf(getObjectByIndex(nfa, 4), state));
+    }
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"cdabgh"))) == true);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"cdab"))) == false);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"cd\u20acgh"))) == false);
+
+    // Nested iterations put the ε-transitions on cycles that share one closure
+    c = compileNFA(regexNFA(wordFromString(L"((a)*b*)*c")));
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"abbaac"))) == true);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"c"))) == true);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"abba"))) == false);
+
+    // Letters that move alike share a class, letters that move nowhere fall into class 0
+    c = compileNFA(optimizeNFA(regexNFA(wordFromString(L"(a|b|c)d|e"))));
+    assert(getCompiledClassCount(c) == 4);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"bd"))) == true);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"e"))) == true);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"dd"))) == false);
+    assert(runCompiledNFA(c, PackedWord(wordFromString(L"ed"))) == false);
+
+    print(L"Compiled regex NFA test successful\n\n");
+}
+
+void optimizedRegexNFATest(void)
+{
+    // Without ε-transitions and dead states the automaton is a fraction of the construction
+    nondeterministic_finite_automaton nfa = regexNFA(wordFromString(L"(ab|cd)*(ef|gh)"));
+    nondeterministic_finite_automaton optimized = optimizeNFA(nfa);
+    printNFA(optimized);
+
+    (void)optimized;
+    assert(getCardinality(getObjectByIndex(optimized, 0)) == 6);
+    assert(getCardinality(getObjectByIndex(optimizeNFA(optimized), 0)) == 6);
+    assert(getObjectByIndex(optimized, 3) == getObjectByIndex(nfa, 3));
+
+    const wchar_t *inputs[] = {L"abef", L"cdabgh", L"gh", L"ab", L"efgh", L"ghab", L""};
+    for (unsigned int i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+    {
+        word w = wordFromString(inputs[i]);
+        (void)w;
+        assert(runNFA(optimized, w) == runNFA(nfa, w));
+    }
+
+    // q2 is reached but leads nowhere, q3 leads to q1 but is never reached
+    word q0 = wordFromString(L"q0");
+    word q1 = wordFromString(L"q1");
+    word q2 = wordFromString(L"q2");
+    word q3 = wordFromString(L"q3");
+    set_builder delta_relation = SetBuilder();
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), q0), letter_a), addToSet(Set(), q1));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), q0), letter_b), addToSet(Set(), q2));
+    addToRelationBuilder(delta_relation, addToSet(addToSet(Set(), q3), letter_a), addToSet(Set(), q1));
+    set states = addToSet(addToSet(addToSet(addToSet(Set(), q0), q1), q2), q3);
+    set alphabet = addToSet(addToSet(Set(), letter_a), letter_b);
+    nfa = NondeterministicFiniteAutomaton(states, alphabet, relationToNFADeltaFunction(buildSet(delta_relation)), q0, addToSet(Set(), q1));
+    optimized = optimizeNFA(nfa);
+    assert(getCardinality(getObjectByIndex(optimized, 0)) == 2);
+    assert(isElementOf(getObjectByIndex(optimized, 0), q1) && !isElementOf(getObjectByIndex(optimized, 0), q2));
+    assert(runNFA(optimized, wordFromString(L"a")) == true);
+    assert(runNFA(optimized, wordFromString(L"b")) == false);
+
+    print(L"Optimized regex NFA test successful\n\n");
+}
+
+static void *regexNFAWorker(void *arg)
+{
+    (void)arg;
+    nondeterministic_finite_automaton nfa = regexNFA(wordFromString(L"(ab|cd)*(ef|gh)"));
+
+    bool res = runNFA(nfa, wordFromString(L"abcdgh"));
+    (void)res;
+    assert(res == true);
+    res = runNFA(nfa, wordFromString(L"cdef"));
+    assert(res == true);
+    res = runNFA(nfa, wordFromString(L"efgh"));
+    assert(res == false);
+
+    return NULL;
+}
+
+// Processor seconds for length steps of (a|b)*(a|b)*…c with the given number of stars; every
+// star stays active, so each step adds long ε-closures
+double compiledNFAStepTime(unsigned int stars, unsigned int length)
+{
+    wchar_t *pattern = malloc((6 * stars + 2) * sizeof(wchar_t));
+    assert(pattern != NULL);
+    for (unsigned int i = 0; i < stars; i++)
+        wcscpy(pattern + 6 * i, L"(a|b)*");
+    wcscpy(pattern + 6 * stars, L"c");
+    compiled_nfa c = compileNFA(regexNFA(wordFromString(pattern)));
+    free(pattern);
+
+    compiled_nfa_run r = CompiledNFARun(c);
+    clock_t start = clock();
+    for (unsigned int i = 0; i < length; i++)
+        stepCompiledNFARun(&r, (i % 3 != 0) ? letter_a : letter_b);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    assert(r.active > 0 && !isCompiledNFARunAccepting(&r));
+    stepCompiledNFARun(&r, Letter(L'c'));
+    assert(isCompiledNFARunAccepting(&r));
+    freeCompiledNFARun(&r);
+    return seconds;
+}
+
+// Only prints: processor time depends on the machine and its load, so the ratio is for reading,
+// not for asserting. A step costs the states it adds, so four times the states should take about
+// four times as long
+void compiledNFAScalingBenchmark(void)
+{
+    double small = compiledNFAStepTime(25, 20000);
+    double large = compiledNFAStepTime(100, 20000);
+
+    print(L"Compiled NFA steps: 20000 over 25 stars in %u ms, over 100 stars in %u ms\n\n", (unsigned int)(small * 1000), (unsigned int)(large * 1000));
+}
+
+void concurrentRegexNFATest(void)
+{
+    // Independent threads compile and run automata over the shared universe
+    pthread_t threads[4];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        int err = pthread_create(&threads[i], NULL, regexNFAWorker, NULL);
+        (void)err;
+        assert(err == 0);
+    }
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    print(L"Concurrent regex NFA test successful\n\n");
+}
+
+void sweepUniverseTest(void)
+{
+    // Compile, match and drop the same NFA repeatedly in bounded memory
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        beginSetGeneration();
+        nondeterministic_finite_automaton nfa = regexNFA(wordFromString(L"(ab|cd)*(ef|gh)"));
+        markSetAsRoot(nfa);
+        sweepUniverse();
+
+        bool res = runNFA(nfa, wordFromString(L"abcdgh"));
+        (void)res;
+        assert(res == true);
+        res = runNFA(nfa, wordFromString(L"ghab"));
+        assert(res == false);
+
+        unmarkSetAsRoot(nfa);
+        sweepUniverse();
+    }
+
+    print(L"Universe sweep test successful\n\n");
+}
+
+void letterSetTest(void)
+{
+    // Sets of letters take the bitmap path, mixing in a non-letter takes the sorted one
+    set ab = addToSet(addToSet(Set(), letter_a), letter_b);
+    set bc = addToSet(addToSet(Set(), letter_b), letter_c);
+    set mixed = addToSet(bc, Set());
+
+    (void)ab;
+    (void)mixed;
+    assert(getCardinality(unionSet(ab, bc)) == 3);
+    assert(intersectionSet(ab, bc) == addToSet(Set(), letter_b));
+    assert(differenceSet(ab, bc) == addToSet(Set(), letter_a));
+    assert(differenceSet(ab, ab) == Set());
+    assert(unionSet(ab, mixed) == addToSet(unionSet(ab, bc), Set()));
+    assert(intersectionSet(ab, mixed) == intersectionSet(ab, bc));
+    assert(differenceSet(mixed, ab) == addToSet(addToSet(Set(), letter_c), Set()));
+    assert(isElementOf(ab, letter_a) && !isElementOf(ab, letter_c) && !isElementOf(ab, Set()));
+    assert(isSubsetOf(intersectionSet(ab, bc), mixed) && !isSubsetOf(ab, mixed) && !isSubsetOf(mixed, bc));
+    assert(areDisjoint(differenceSet(ab, bc), mixed) && !areDisjoint(ab, mixed) && areDisjoint(Set(), ab));
+
+    print(L"Letter set test successful\n\n");
+}
+
+void wordEncodingTest(void)
+{
+    // Utf-8 round trips, malformed input comes back as u+fffd
+    const char *text = "a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80z";
+    char out[16];
+    size_t n = encodeWordUTF8(wordFromUTF8(text, 11), out, sizeof(out));
+    (void)n;
+    assert(n == 11 && memcmp(out, text, 12) == 0);
+    n = encodeWordUTF8(wordFromUTF8("\xc3x\xff", 3), out, sizeof(out));
+    assert(n == 7 && strcmp(out, "\xef\xbf\xbdx\xef\xbf\xbd") == 0);
+
+    // Too small buffers get what fits and a terminator, the full length is still returned
+    n = encodeWordUTF8(wordFromUTF8(text, 11), out, 4);
+    assert(n == 11 && strcmp(out, "a\xc3\xa9") == 0);
+    wchar_t wide[8];
+    n = encodeWord(wordFromString(L"abcdef"), wide, 4);
+    assert(n == 6 && wcscmp(wide, L"abc") == 0);
+    n = encodeWord(wordFromString(L"abcdef"), wide, 0);
+    assert(n == 6);
+
+    // Without a stream the print buffer truncates the same way and counts what it dropped
+    print_buffer b = PrintBuffer(NULL, wide, 8);
+    printToBuffer(&b, L"%lw-%u|%d", wordFromString(L"abcde"), 42u, -7);
+    flushPrintBuffer(&b);
+    assert(b.length == 11 && wcscmp(wide, L"abcde-4") == 0);
+
+    print(L"Word encoding test successful\n\n");
+}
+
+void relationIndexTest(void)
+{
+    // a -> b, a -> c, b -> c
+    relation r = addToRelation(addToRelation(addToRelation(Relation(), letter_a, letter_b), letter_a, letter_c), letter_b, letter_c);
+    set ab = addToSet(addToSet(Set(), letter_a), letter_b);
+    set bc = addToSet(addToSet(Set(), letter_b), letter_c);
+
+    (void)r;
+    (void)ab;
+    (void)bc;
+    assert(getRelationImage(r, letter_a).cardinality == 2);
+    assert(getRelationPreimage(r, letter_c).cardinality == 2);
+    assert(getRelationImage(r, letter_c).cardinality == 0);
+    assert(getRelationImageOfSet(r, ab) == bc);
+    assert(getRelationValue(r, letter_b) == addToSet(Set(), letter_c));
+
+    print(L"Relation index test successful\n\n");
+}
+
+void functionIndexTest(void)
+{
+    // Built pair by pair, every function on the way stays frozen and keeps the first value
+    letter letters[] = {letter_a, letter_b, letter_c, letter_d, letter_e};
+    function f = Function();
+    for (unsigned int i = 0; i < 5; i++)
+    {
+        f = addToFunction(f, letters[i], letters[(i * 3) % 5]);
+        assert(addToFunction(f, letters[i], letter_f) == f);
+        assert(isRelationFrozen(f));
+    }
+
+    assert(getCardinality(f) == 5);
+    assert(getFunctionValue(f, letter_f) == NULL);
+    for (unsigned int i = 0; i < 5; i++)
+    {
+        assert(getFunctionValue(f, letters[i]) == letters[(i * 3) % 5]);
+        set_iterator preimage = getRelationPreimage(f, letters[(i * 3) % 5]);
+        (void)preimage;
+        assert(preimage.cardinality == 1 && preimage.elements[0] == letters[i]);
+    }
+
+    print(L"Function index test successful\n\n");
+}
+
+// Brute force counterparts of the relation operators, straight from the definitions
+relation bruteComposition(relation r, relation s)
+{
+    relation c = Relation();
+    for (set_iterator i = SetIterator(r); hasNextElement(&i);)
+    {
+        n_tuple p = nextElement(&i);
+        for (set_iterator j = SetIterator(s); hasNextElement(&j);)
+        {
+            n_tuple q = nextElement(&j);
+            if (getObjectByIndex(p, 1) == getObjectByIndex(q, 0))
+                c = addToRelation(c, getObjectByIndex(p, 0), getObjectByIndex(q, 1));
+        }
+    }
+    return c;
+}
+
+relation bruteInverse(relation r)
+{
+    relation c = Relation();
+    for (set_iterator i = SetIterator(r); hasNextElement(&i);)
+    {
+        n_tuple p = nextElement(&i);
+        c = addToRelation(c, getObjectByIndex(p, 1), getObjectByIndex(p, 0));
+    }
+    return c;
+}
+
+relation bruteRestriction(relation r, set s)
+{
+    relation c = Relation();
+    for (set_iterator i = SetIterator(r); hasNextElement(&i);)
+    {
+        n_tuple p = nextElement(&i);
+        if (isElementOf(s, getObjectByIndex(p, 0)))
+            c = addToSet(c, p);
+    }
+    return c;
+}
+
+set bruteReachable(relation r, set s)
+{
+    set reached = Set();
+    while (reached != s)
+    {
+        reached = s;
+        for (set_iterator i = SetIterator(r); hasNextElement(&i);)
+        {
+            n_tuple p = nextElement(&i);
+            if (isElementOf(reached, getObjectByIndex(p, 0)))
+                s = addToSet(s, getObjectByIndex(p, 1));
+        }
+    }
+    return reached;
+}
+
+relation bruteClosure(relation r, bool reflexive)
+{
+    relation closure = r;
+    relation previous = NULL;
+    while (closure != previous)
+    {
+        previous = closure;
+        closure = unionSet(closure, bruteComposition(closure, r));
+    }
+    if (reflexive)
+    {
+        for (set_iterator i = SetIterator(r); hasNextElement(&i);)
+        {
+            n_tuple p = nextElement(&i);
+            closure = addToRelation(closure, getObjectByIndex(p, 0), getObjectByIndex(p, 0));
+            closure = addToRelation(closure, getObjectByIndex(p, 1), getObjectByIndex(p, 1));
+        }
+    }
+    return closure;
+}
+
+void relationOperatorsTest(void)
+{
+    // Pseudo random relations over eight letters, with cycles, self loops and sinks
+    letter letters[8] = {letter_a, letter_b, letter_c, letter_d, letter_e, letter_f, letter_g, letter_h};
+    unsigned int seed = 7;
+    for (unsigned int round = 0; round < 8; round++)
+    {
+        relation r = Relation();
+        relation s = Relation();
+        set from = Set();
+        for (unsigned int k = 0; k < 4 + 2 * round; k++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            r = addToRelation(r, letters[(seed >> 8) % 8], letters[(seed >> 16) % 8]);
+            seed = seed * 1103515245u + 12345u;
+            s = addToRelation(s, letters[(seed >> 8) % 8], letters[(seed >> 16) % 8]);
+            if ((seed >> 24) % 3 == 0)
+                from = addToSet(from, letters[(seed >> 4) % 8]);
+        }
+
+        assert(compositionRelation(r, s) == bruteComposition(r, s));
+        assert(inverseRelation(r) == bruteInverse(r));
+        assert(restrictionRelation(r, from) == bruteRestriction(r, from));
+        assert(getReachableSet(r, from) == bruteReachable(r, from));
+        assert(transitiveClosureRelation(r) == bruteClosure(r, false));
+        assert(reflexiveTransitiveClosureRelation(r) == bruteClosure(r, true));
+    }
+
+    print(L"Relation operators test successful\n\n");
+}
+
+void graphComponentsTest(void)
+{
+    // 0 → 1 → 2 → 0 is one cycle, 3 hangs off it and 4 stands alone
+    const unsigned int edge_start[] = {0, 1, 2, 4, 4, 4};
+    const unsigned int edges[] = {1, 2, 0, 3};
+    graph g = {5, edge_start, edges};
+    graph_components c = GraphComponents(g);
+
+    assert(c.count == 3);
+    assert(c.component_of[0] == c.component_of[1] && c.component_of[1] == c.component_of[2]);
+    assert(c.component_of[3] < c.component_of[0]);
+    assert(c.member_start[c.count] == 5);
+    for (unsigned int k = 0; k < c.count; k++)
+    {
+        for (unsigned int m = c.member_start[k]; m < c.member_start[k + 1]; m++)
+            assert(c.component_of[c.members[m]] == k);
+    }
+    freeGraphComponents(&c);
+
+    print(L"Graph components test successful\n\n");
+}
+
 int main_automata(void)
 {
     (void)setlocale(LC_ALL, "");
     regexNFATest();
+    unicodeRegexNFATest();
+    streamingRegexNFATest();
+    compiledRegexNFATest();
+    optimizedRegexNFATest();
+    compiledNFAScalingBenchmark();
+    concurrentRegexNFATest();
+    sweepUniverseTest();
+    letterSetTest();
+    wordEncodingTest();
+    relationIndexTest();
+    functionIndexTest();
+    relationOperatorsTest();
+    graphComponentsTest();
+
+#ifdef SET_STATISTICS
+    printSetStatistics();
+#endif
 
     return 0;
 }